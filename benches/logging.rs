@@ -0,0 +1,210 @@
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use log::{LevelFilter, Log, Record};
+use oslog::{os_log_cstr, Level, OsLog, OsLogger};
+use std::ffi::c_void;
+use std::os::raw::c_char;
+use std::time::{Duration, Instant};
+
+const SUBSYSTEM: &str = "com.example.oslog.bench";
+
+/// Message sizes either side of the stack buffer used for short messages.
+const SIZES: [usize; 4] = [16, 128, 1024, 8192];
+
+/// Distinct targets logged to by the contention benchmarks, so threads share
+/// some categories but not all of them.
+const TARGETS: [&str; 4] = ["First", "Second", "Third", "Fourth"];
+
+fn record<'a>(level: log::Level, target: &'a str, args: std::fmt::Arguments<'a>) -> Record<'a> {
+    Record::builder()
+        .level(level)
+        .target(target)
+        .args(args)
+        .build()
+}
+
+fn os_log(c: &mut Criterion) {
+    let log = OsLog::new(SUBSYSTEM, "OsLog");
+    let mut group = c.benchmark_group("os_log");
+
+    group.bench_function("with_level", |b| {
+        b.iter(|| log.with_level(Level::Default, black_box("Message")))
+    });
+
+    group.bench_function("default", |b| b.iter(|| log.default(black_box("Message"))));
+
+    group.bench_function("with_level_cstr", |b| {
+        b.iter(|| log.with_level_cstr(Level::Default, black_box(os_log_cstr!("Message"))))
+    });
+
+    group.bench_function("with_level_args", |b| {
+        let value = 1;
+        b.iter(|| log.with_level_args(Level::Default, format_args!("Message {}", black_box(value))))
+    });
+
+    group.bench_function("level_is_enabled", |b| {
+        b.iter(|| log.level_is_enabled(black_box(Level::Debug)))
+    });
+
+    group.finish();
+}
+
+extern "C" {
+    // Defined in wrapper.c, which is linked in through the crate.
+    fn wrapped_get_default_log() -> *mut c_void;
+    fn wrapped_os_log_default_baseline(log: *mut c_void, message: *const c_char);
+}
+
+/// The entry point every level goes through now, against a copy of the
+/// per-level shim it replaced, which is never inlined. Without
+/// `RUSTFLAGS="-Clinker-plugin-lto"` both are a call across the FFI boundary
+/// and should be level. With it, the gap is what inlining the shim saves.
+fn levels(c: &mut Criterion) {
+    let log = OsLog::global();
+    let raw = unsafe { wrapped_get_default_log() };
+    let message = os_log_cstr!("Message");
+    let mut group = c.benchmark_group("levels");
+
+    group.bench_function("with_level_cstr", |b| {
+        b.iter(|| log.with_level_cstr(Level::Default, black_box(message)))
+    });
+
+    group.bench_function("baseline_shim", |b| {
+        b.iter(|| unsafe {
+            wrapped_os_log_default_baseline(black_box(raw), black_box(message).as_ptr())
+        })
+    });
+
+    group.finish();
+}
+
+/// Messages have to be copied to nul terminate them, and any interior nul
+/// bytes replaced, before they can be handed to the OS.
+fn messages(c: &mut Criterion) {
+    let log = OsLog::new(SUBSYSTEM, "Messages");
+    let mut group = c.benchmark_group("messages");
+
+    for size in SIZES {
+        let plain = "a".repeat(size);
+        let mut nul = plain.clone();
+        nul.replace_range(size / 2..size / 2 + 1, "\0");
+
+        group.throughput(Throughput::Bytes(size as u64));
+
+        group.bench_with_input(BenchmarkId::new("plain", size), &plain, |b, message| {
+            b.iter(|| log.with_level(Level::Default, message))
+        });
+
+        group.bench_with_input(
+            BenchmarkId::new("interior_nul", size),
+            &nul,
+            |b, message| b.iter(|| log.with_level(Level::Default, message)),
+        );
+    }
+
+    group.finish();
+}
+
+fn logger(c: &mut Criterion) {
+    let mut group = c.benchmark_group("logger");
+
+    let logger = OsLogger::new(SUBSYSTEM).level_filter(LevelFilter::Info);
+
+    group.bench_function("cached_target", |b| {
+        b.iter(|| logger.log(&record(log::Level::Info, "Cached", format_args!("Message"))))
+    });
+
+    // Every iteration creates a category, which is what the first record for
+    // each target costs.
+    group.bench_function("new_target", |b| {
+        b.iter_custom(|iters| {
+            let logger = OsLogger::new(SUBSYSTEM).level_filter(LevelFilter::Info);
+            let targets: Vec<String> = (0..iters).map(|i| format!("New{}", i)).collect();
+
+            let start = Instant::now();
+
+            for target in &targets {
+                logger.log(&record(log::Level::Info, target, format_args!("Message")));
+            }
+
+            start.elapsed()
+        })
+    });
+
+    group.bench_function("disabled_by_filter", |b| {
+        b.iter(|| {
+            logger.log(&record(
+                log::Level::Debug,
+                "Cached",
+                format_args!("Message"),
+            ))
+        })
+    });
+
+    group.bench_function("enabled", |b| {
+        b.iter(|| logger.enabled(&record(log::Level::Info, "Cached", format_args!("")).metadata()))
+    });
+
+    group.bench_function("disabled", |b| {
+        b.iter(|| logger.enabled(&record(log::Level::Debug, "Cached", format_args!("")).metadata()))
+    });
+
+    group.finish();
+}
+
+/// Logs from several threads at once to a handful of shared targets, which is
+/// where contention on the category registry would show up.
+fn contention(c: &mut Criterion) {
+    let mut group = c.benchmark_group("contention");
+    let logger = OsLogger::new(SUBSYSTEM).level_filter(LevelFilter::Info);
+
+    let max_threads = std::thread::available_parallelism().map_or(4, |n| n.get());
+    let threads = (0..)
+        .map(|shift| 1 << shift)
+        .take_while(|&threads| threads <= max_threads);
+
+    for threads in threads {
+        group.throughput(Throughput::Elements(threads as u64));
+
+        group.bench_with_input(
+            BenchmarkId::from_parameter(threads),
+            &threads,
+            |b, &threads| {
+                b.iter_custom(|iters| {
+                    let logger = &logger;
+
+                    std::thread::scope(|scope| {
+                        let handles: Vec<_> = (0..threads)
+                            .map(|thread| {
+                                scope.spawn(move || {
+                                    let start = Instant::now();
+
+                                    for i in 0..iters as usize {
+                                        let target = TARGETS[(thread + i) % TARGETS.len()];
+                                        logger.log(&record(
+                                            log::Level::Info,
+                                            target,
+                                            format_args!("Message"),
+                                        ));
+                                    }
+
+                                    start.elapsed()
+                                })
+                            })
+                            .collect();
+
+                        handles
+                            .into_iter()
+                            .map(|handle| handle.join().unwrap())
+                            .max()
+                            .unwrap_or(Duration::ZERO)
+                    })
+                })
+            },
+        );
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, os_log, levels, messages, logger, contention);
+criterion_main!(benches);
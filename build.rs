@@ -1,3 +1,21 @@
 fn main() {
-    cc::Build::new().file("wrapper.c").compile("wrapper");
+    let mut build = cc::Build::new();
+    build.file("wrapper.c");
+
+    // With `-Clinker-plugin-lto` rustc emits LLVM bitcode and leaves the
+    // optimization to the linker, so compiling the shims to bitcode as well
+    // lets them be inlined across the FFI boundary. Requires clang built from
+    // the same LLVM version as rustc.
+    let rustflags = std::env::var("CARGO_ENCODED_RUSTFLAGS").unwrap_or_default();
+
+    if rustflags
+        .split('\x1f')
+        .any(|flag| flag.contains("linker-plugin-lto"))
+    {
+        build.flag("-flto=thin");
+    }
+
+    build.compile("wrapper");
+
+    println!("cargo:rerun-if-changed=wrapper.c");
 }
@@ -0,0 +1,287 @@
+use crate::sys::*;
+use std::ffi::c_void;
+use std::marker::PhantomData;
+use std::ops::BitOr;
+use std::panic::{self, AssertUnwindSafe};
+use std::ptr;
+use std::sync::OnceLock;
+use std::thread;
+
+/// Creates an `OsActivity` with a static description, which is a child of the
+/// current thread's activity unless the flags say otherwise. Messages logged
+/// while it's active are grouped under it, by Console for example.
+///
+/// No activity is created if activity tracing has been disabled for the
+/// process with `OS_ACTIVITY_MODE=disable`, in which case using the returned
+/// activity does nothing.
+///
+/// ```
+/// use oslog::{os_activity, ActivityFlags, OsLog};
+///
+/// let log = OsLog::new("com.example.test", "Requests");
+/// let activity = os_activity!("Handle request");
+///
+/// let _scope = activity.enter();
+/// log.default("Everything logged here is part of the request");
+///
+/// let background = os_activity!("Refresh cache", ActivityFlags::DETACHED);
+/// background.apply(|| log.default("Part of the refresh instead"));
+/// ```
+#[macro_export]
+macro_rules! os_activity {
+    ($description:literal $(,)?) => {
+        $crate::os_activity!($description, $crate::ActivityFlags::DEFAULT)
+    };
+    ($description:literal, $flags:expr $(,)?) => {{
+        static DESCRIPTION: [u8; $description.len() + 1] = $crate::format::terminate($description);
+        unsafe { $crate::OsActivity::with_description(&DESCRIPTION, $flags) }
+    }};
+}
+
+/// Changes how an activity relates to the current one.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct ActivityFlags(os_activity_flag_t);
+
+impl ActivityFlags {
+    pub const DEFAULT: Self = Self(OS_ACTIVITY_FLAG_DEFAULT);
+
+    /// Creates a top level activity, rather than a child of the current one.
+    pub const DETACHED: Self = Self(OS_ACTIVITY_FLAG_DETACHED);
+
+    /// Only creates an activity if there's no current one, otherwise the
+    /// current one is used.
+    pub const IF_NONE_PRESENT: Self = Self(OS_ACTIVITY_FLAG_IF_NONE_PRESENT);
+}
+
+impl BitOr for ActivityFlags {
+    type Output = Self;
+
+    fn bitor(self, other: Self) -> Self {
+        Self(self.0 | other.0)
+    }
+}
+
+/// Whether activity tracing is enabled for the process, which is checked
+/// once so disabled activities cost nothing to create.
+fn activities_enabled() -> bool {
+    static ENABLED: OnceLock<bool> = OnceLock::new();
+
+    *ENABLED
+        .get_or_init(|| std::env::var_os("OS_ACTIVITY_MODE").map_or(true, |mode| mode != "disable"))
+}
+
+/// Groups the messages which are logged while it's active, along with those
+/// of any activities created while it's active.
+pub struct OsActivity {
+    /// Null if activities are disabled.
+    inner: os_activity_t,
+}
+
+unsafe impl Send for OsActivity {}
+unsafe impl Sync for OsActivity {}
+
+impl Drop for OsActivity {
+    fn drop(&mut self) {
+        if !self.inner.is_null() {
+            unsafe { os_release(self.inner as *mut c_void) }
+        }
+    }
+}
+
+impl OsActivity {
+    /// # Safety
+    ///
+    /// `description` must be nul terminated and live for the rest of the
+    /// program in this image, as `os_activity!` ensures.
+    #[doc(hidden)]
+    pub unsafe fn with_description(description: &'static [u8], flags: ActivityFlags) -> Self {
+        if !activities_enabled() {
+            return Self::disabled();
+        }
+
+        let inner = wrapped_os_activity_create(description.as_ptr() as *const _, flags.0);
+
+        assert!(
+            !inner.is_null(),
+            "Unexpected null value from os_activity_create"
+        );
+
+        Self { inner }
+    }
+
+    /// An activity which does nothing when used.
+    pub fn disabled() -> Self {
+        Self {
+            inner: ptr::null_mut(),
+        }
+    }
+
+    pub fn is_enabled(&self) -> bool {
+        !self.inner.is_null()
+    }
+
+    /// The activity's identifier, or `None` if it's disabled.
+    pub fn id(&self) -> Option<u64> {
+        if self.inner.is_null() {
+            return None;
+        }
+
+        Some(unsafe { os_activity_get_identifier(self.inner, ptr::null_mut()) })
+    }
+
+    /// The identifier of the current thread's activity, or `None` if it has
+    /// none.
+    pub fn current_id() -> Option<u64> {
+        let id =
+            unsafe { os_activity_get_identifier(wrapped_os_activity_current(), ptr::null_mut()) };
+        Some(id).filter(|&id| id != 0)
+    }
+
+    /// Makes this the current thread's activity until the returned scope is
+    /// dropped. Scopes must be dropped in the reverse order they were entered,
+    /// which holding them in local variables takes care of.
+    pub fn enter(&self) -> ActivityScope<'_> {
+        let mut state = os_activity_scope_state_s::default();
+
+        if !self.inner.is_null() {
+            unsafe { os_activity_scope_enter(self.inner, &mut state) }
+        }
+
+        // The state is only identifiers, so it's fine to move it.
+        ActivityScope {
+            state,
+            active: !self.inner.is_null(),
+            _activity: PhantomData,
+        }
+    }
+
+    /// Makes this the current thread's activity without a guard, for callers
+    /// which have to leave it from somewhere else, returning the state to
+    /// leave it with. Returns `None` if the activity is disabled.
+    #[cfg(feature = "tracing")]
+    pub(crate) fn scope_enter(&self) -> Option<os_activity_scope_state_s> {
+        if self.inner.is_null() {
+            return None;
+        }
+
+        let mut state = os_activity_scope_state_s::default();
+        unsafe { os_activity_scope_enter(self.inner, &mut state) }
+        Some(state)
+    }
+
+    /// # Safety
+    ///
+    /// `state` must have come from `scope_enter` on this thread, and scopes
+    /// must be left in the reverse order they were entered.
+    #[cfg(feature = "tracing")]
+    pub(crate) unsafe fn scope_leave(mut state: os_activity_scope_state_s) {
+        os_activity_scope_leave(&mut state)
+    }
+
+    /// Calls `f` with this as the current thread's activity.
+    pub fn apply<F: FnOnce() -> R, R>(&self, f: F) -> R {
+        if self.inner.is_null() {
+            return f();
+        }
+
+        struct Context<F, R> {
+            f: Option<F>,
+            result: Option<thread::Result<R>>,
+        }
+
+        extern "C" fn call<F: FnOnce() -> R, R>(context: *mut c_void) {
+            let context = unsafe { &mut *(context as *mut Context<F, R>) };
+            let f = context.f.take().unwrap();
+
+            // Unwinding into the OS isn't allowed, so panics are caught here
+            // and resumed once it has returned.
+            context.result = Some(panic::catch_unwind(AssertUnwindSafe(f)));
+        }
+
+        let mut context = Context {
+            f: Some(f),
+            result: None,
+        };
+
+        unsafe {
+            os_activity_apply_f(
+                self.inner,
+                &mut context as *mut Context<F, R> as *mut c_void,
+                call::<F, R>,
+            )
+        }
+
+        match context
+            .result
+            .expect("os_activity_apply_f didn't call the function")
+        {
+            Ok(result) => result,
+            Err(panic) => panic::resume_unwind(panic),
+        }
+    }
+}
+
+/// Keeps an activity current for the thread which entered it until dropped.
+#[must_use = "the activity is left as soon as this is dropped"]
+pub struct ActivityScope<'a> {
+    state: os_activity_scope_state_s,
+    active: bool,
+    /// Borrows the activity, and isn't `Send` because the scope has to be
+    /// left on the thread which entered it.
+    _activity: PhantomData<(&'a OsActivity, *const ())>,
+}
+
+impl Drop for ActivityScope<'_> {
+    fn drop(&mut self) {
+        if self.active {
+            unsafe { os_activity_scope_leave(&mut self.state) }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_scopes() {
+        let outer = crate::os_activity!("Outer");
+        let inner = crate::os_activity!("Inner");
+        assert!(outer.is_enabled());
+        assert_ne!(outer.id(), inner.id());
+
+        let previous = OsActivity::current_id();
+
+        {
+            let _outer = outer.enter();
+            assert_eq!(OsActivity::current_id(), outer.id());
+
+            let _inner = inner.enter();
+            assert_eq!(OsActivity::current_id(), inner.id());
+        }
+
+        assert_eq!(OsActivity::current_id(), previous);
+    }
+
+    #[test]
+    fn test_apply() {
+        let activity = crate::os_activity!("Apply", ActivityFlags::DETACHED);
+        let id = activity.apply(OsActivity::current_id);
+        assert_eq!(id, activity.id());
+
+        let result = panic::catch_unwind(|| activity.apply(|| panic!("Inside")));
+        assert!(result.is_err());
+    }
+
+    #[test]
+    fn test_disabled() {
+        let activity = OsActivity::disabled();
+        assert!(!activity.is_enabled());
+        assert_eq!(activity.id(), None);
+
+        let previous = OsActivity::current_id();
+        let _scope = activity.enter();
+        assert_eq!(OsActivity::current_id(), previous);
+        assert_eq!(activity.apply(|| 1), 1);
+    }
+}
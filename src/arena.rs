@@ -0,0 +1,270 @@
+use std::cell::{RefCell, UnsafeCell};
+use std::fmt::{self, Write};
+use std::sync::Arc;
+use std::{slice, str};
+
+/// The size of each chunk which messages are formatted into.
+const CHUNK_LEN: usize = 16 * 1024;
+
+/// A message is started in a fresh chunk if less than this is left, so only
+/// messages longer than this can end up on the heap.
+const MIN_SPACE: usize = 256;
+
+/// Chunks which are still in use when they fill up are kept, up to this
+/// many, so they can be reused once their messages have been emitted.
+const MAX_SPARE_CHUNKS: usize = 4;
+
+/// A block of memory which a single thread formats messages into. Each message
+/// holds a reference to the chunk, so it's only reused once all of them have
+/// been dropped.
+pub(crate) struct Chunk {
+    bytes: Box<[UnsafeCell<u8>]>,
+}
+
+// Safety: the owning thread only writes past the messages which have been
+// handed out, and those are only read.
+unsafe impl Send for Chunk {}
+unsafe impl Sync for Chunk {}
+
+impl Chunk {
+    fn new() -> Arc<Self> {
+        Arc::new(Self {
+            bytes: (0..CHUNK_LEN).map(|_| UnsafeCell::new(0)).collect(),
+        })
+    }
+
+    fn ptr(&self) -> *mut u8 {
+        self.bytes.as_ptr() as *mut u8
+    }
+}
+
+/// A formatted message, which is usually in one of the formatting thread's
+/// chunks rather than a heap allocation of its own.
+pub(crate) enum Text {
+    Arena {
+        chunk: Arc<Chunk>,
+        start: usize,
+        len: usize,
+    },
+    Heap(String),
+}
+
+impl Text {
+    pub fn format(args: fmt::Arguments) -> Self {
+        ARENA
+            .try_with(|arena| {
+                // Fails if a Display implementation being formatted logs too.
+                let mut arena = arena.try_borrow_mut().ok()?;
+                Some(arena.format(args))
+            })
+            .ok()
+            .flatten()
+            .unwrap_or_else(|| Text::Heap(args.to_string()))
+    }
+
+    pub fn as_str(&self) -> &str {
+        match self {
+            Text::Arena { chunk, start, len } => unsafe {
+                // Safety: only whole strs are copied into the chunk, and this
+                // range isn't written again until the message is dropped.
+                str::from_utf8_unchecked(slice::from_raw_parts(chunk.ptr().add(*start), *len))
+            },
+            Text::Heap(text) => text,
+        }
+    }
+}
+
+/// The chunks belonging to one thread.
+struct Arena {
+    current: Option<Arc<Chunk>>,
+    /// How much of the current chunk has been handed out.
+    used: usize,
+    spare: Vec<Arc<Chunk>>,
+}
+
+thread_local! {
+    static ARENA: RefCell<Arena> = RefCell::new(Arena {
+        current: None,
+        used: 0,
+        spare: Vec::new(),
+    });
+}
+
+impl Arena {
+    fn format(&mut self, args: fmt::Arguments) -> Text {
+        let chunk = self.reserve();
+        let start = self.used;
+
+        let mut writer = ArenaWriter {
+            chunk: &chunk,
+            start,
+            used: &mut self.used,
+            spilled: None,
+        };
+
+        // An error can only come from a Display implementation, in which case
+        // whatever was written before it is still logged.
+        let _ = writer.write_fmt(args);
+
+        match writer.spilled {
+            Some(text) => {
+                // Nothing else refers to what was written, so it can be reused.
+                self.used = start;
+                Text::Heap(text)
+            }
+            None => Text::Arena {
+                len: self.used - start,
+                chunk,
+                start,
+            },
+        }
+    }
+
+    /// Returns the chunk to format the next message into, rewinding it first if
+    /// its messages have all been dropped, or replacing it if it's nearly full.
+    fn reserve(&mut self) -> Arc<Chunk> {
+        if let Some(current) = &mut self.current {
+            if Arc::get_mut(current).is_some() {
+                self.used = 0;
+            }
+
+            if CHUNK_LEN - self.used >= MIN_SPACE {
+                return current.clone();
+            }
+        }
+
+        let reusable = self
+            .spare
+            .iter_mut()
+            .position(|chunk| Arc::get_mut(chunk).is_some());
+
+        let next = match reusable {
+            Some(index) => self.spare.swap_remove(index),
+            None => Chunk::new(),
+        };
+
+        if let Some(full) = self.current.replace(next) {
+            if self.spare.len() < MAX_SPARE_CHUNKS {
+                self.spare.push(full);
+            }
+        }
+
+        self.used = 0;
+        self.current.clone().unwrap()
+    }
+}
+
+/// Appends to a chunk, moving the message to the heap if it doesn't fit.
+struct ArenaWriter<'a> {
+    chunk: &'a Chunk,
+    start: usize,
+    used: &'a mut usize,
+    spilled: Option<String>,
+}
+
+impl Write for ArenaWriter<'_> {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        if let Some(spilled) = &mut self.spilled {
+            spilled.push_str(s);
+        } else if CHUNK_LEN - *self.used >= s.len() {
+            unsafe {
+                // Safety: this part of the chunk hasn't been handed out.
+                let end = self.chunk.ptr().add(*self.used);
+                end.copy_from_nonoverlapping(s.as_ptr(), s.len());
+            }
+
+            *self.used += s.len();
+        } else {
+            let written = unsafe {
+                // Safety: as for `Text::as_str`.
+                let start = self.chunk.ptr().add(self.start);
+                str::from_utf8_unchecked(slice::from_raw_parts(start, *self.used - self.start))
+            };
+
+            let mut spilled = String::with_capacity(written.len() + s.len());
+            spilled.push_str(written);
+            spilled.push_str(s);
+            self.spilled = Some(spilled);
+        }
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn chunk(text: &Text) -> *const Chunk {
+        match text {
+            Text::Arena { chunk, .. } => Arc::as_ptr(chunk),
+            Text::Heap(_) => std::ptr::null(),
+        }
+    }
+
+    #[test]
+    fn test_format() {
+        let value = 1;
+        let first = Text::format(format_args!("First {}", value));
+        let second = Text::format(format_args!("Second {}", "\0"));
+
+        assert_eq!(first.as_str(), "First 1");
+        assert_eq!(second.as_str(), "Second \0");
+        assert!(!chunk(&first).is_null());
+        assert_eq!(chunk(&first), chunk(&second));
+    }
+
+    #[test]
+    fn test_reuse() {
+        let first = Text::format(format_args!("{}", "a".repeat(CHUNK_LEN / 2)));
+        let pointer = first.as_str().as_ptr();
+        drop(first);
+
+        let second = Text::format(format_args!("{}", "b"));
+        assert_eq!(second.as_str().as_ptr(), pointer);
+    }
+
+    #[test]
+    fn test_full_chunks() {
+        let long = "a".repeat(CHUNK_LEN - MIN_SPACE + 1);
+        let held: Vec<Text> = (0..MAX_SPARE_CHUNKS + 2)
+            .map(|_| Text::format(format_args!("{}", long)))
+            .collect();
+
+        for text in &held {
+            assert_eq!(text.as_str(), long);
+        }
+
+        let chunks: Vec<_> = held.iter().map(chunk).collect();
+        assert!(chunks.windows(2).all(|pair| pair[0] != pair[1]));
+
+        drop(held);
+        let next = Text::format(format_args!("{}", long));
+        assert_eq!(next.as_str(), long);
+    }
+
+    #[test]
+    fn test_spill() {
+        let huge = "a".repeat(CHUNK_LEN + 1);
+        let text = Text::format(format_args!("{}{}", "b", huge));
+
+        assert!(chunk(&text).is_null());
+        assert_eq!(text.as_str().len(), CHUNK_LEN + 2);
+        assert!(text.as_str().starts_with("ba"));
+    }
+
+    #[test]
+    fn test_reentrant() {
+        struct Nested;
+
+        impl fmt::Display for Nested {
+            fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+                let inner = Text::format(format_args!("{}", "Inner"));
+                f.write_str(inner.as_str())
+            }
+        }
+
+        let text = Text::format(format_args!("{} Outer", Nested));
+        assert_eq!(text.as_str(), "Inner Outer");
+    }
+}
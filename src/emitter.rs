@@ -0,0 +1,424 @@
+use crate::arena::Text;
+use crate::fork;
+use crate::registry::Category;
+use crate::ring::Ring;
+use crate::{Level, Location};
+use std::ptr;
+use std::sync::atomic::{fence, AtomicBool, AtomicPtr, AtomicUsize, Ordering};
+use std::sync::{Arc, Condvar, Mutex};
+use std::thread;
+use std::time::Duration;
+
+/// How often the emitter reports progress while draining a long queue, so
+/// blocked producers and flushes don't wait for the whole queue.
+const PROGRESS_INTERVAL: usize = 64;
+
+/// The most consecutive messages for the same category which are output with
+/// a single call into the OS.
+const MAX_BATCH_LEN: usize = 32;
+
+/// Bounds how long a waiter sleeps without being notified.
+const WAIT_TIMEOUT: Duration = Duration::from_millis(10);
+
+/// What to do with a record when the asynchronous logger's queue is full.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Overflow {
+    /// Discard the record, so logging never blocks.
+    Drop,
+    /// Wait until the background thread has made room for it.
+    Block,
+}
+
+/// A formatted record waiting to be emitted.
+pub(crate) struct Message {
+    pub category: Arc<Category>,
+    pub level: Level,
+    pub location: Option<Location<'static>>,
+    pub text: Text,
+}
+
+struct Shared {
+    ring: Ring<Message>,
+    overflow: Overflow,
+    /// Only written by the background thread, once messages have been output.
+    emitted: AtomicUsize,
+    dropped: AtomicUsize,
+    sleeping: AtomicBool,
+    waiters: AtomicUsize,
+    shutdown: AtomicBool,
+    lock: Mutex<()>,
+    /// Wakes the background thread when there are messages.
+    wake: Condvar,
+    /// Wakes producers waiting for room and threads waiting for a flush.
+    progress: Condvar,
+}
+
+/// Hands messages to a background thread which outputs them, so the threads
+/// which log don't pay for the FFI call. The thread is started when the first
+/// message is sent, and again in a child process after a fork.
+pub(crate) struct Emitter {
+    capacity: usize,
+    overflow: Overflow,
+    /// From `Arc::into_raw`, or null until the thread has been started. In a
+    /// child process the parent's is leaked rather than dropped, since its
+    /// locks may be held by threads which don't exist there and its messages
+    /// are the parent's to output.
+    shared: AtomicPtr<Shared>,
+    /// The fork generation `shared` belongs to.
+    generation: AtomicUsize,
+    /// Set if the thread couldn't be started, in which case messages are
+    /// output by the thread which sends them.
+    failed: AtomicBool,
+}
+
+impl Emitter {
+    pub fn new(capacity: usize) -> Self {
+        Self {
+            capacity,
+            overflow: Overflow::Drop,
+            shared: AtomicPtr::new(ptr::null_mut()),
+            generation: AtomicUsize::new(fork::generation()),
+            failed: AtomicBool::new(false),
+        }
+    }
+
+    pub fn set_overflow(&mut self, overflow: Overflow) {
+        self.overflow = overflow;
+    }
+
+    /// The running thread's state, if there is one in this process.
+    #[inline]
+    fn current(&self) -> Option<&Shared> {
+        let generation = fork::generation();
+
+        if self.generation.load(Ordering::Acquire) != generation {
+            self.forked(generation);
+        }
+
+        // Safety: only dropped along with the emitter.
+        unsafe { self.shared.load(Ordering::Acquire).as_ref() }
+    }
+
+    #[cold]
+    fn forked(&self, generation: usize) {
+        let previous = self.generation.load(Ordering::Acquire);
+
+        // Whichever thread moves the generation on forgets the old state. A
+        // message which another thread queues to it at the same time is lost.
+        if previous != generation
+            && self
+                .generation
+                .compare_exchange(previous, generation, Ordering::AcqRel, Ordering::Acquire)
+                .is_ok()
+        {
+            self.shared.store(ptr::null_mut(), Ordering::Release);
+            self.failed.store(false, Ordering::Relaxed);
+        }
+    }
+
+    fn shared(&self) -> Option<&Shared> {
+        match self.current() {
+            Some(shared) => Some(shared),
+            None if self.failed.load(Ordering::Relaxed) => None,
+            None => self.start(),
+        }
+    }
+
+    #[cold]
+    fn start(&self) -> Option<&Shared> {
+        let shared = Arc::new(Shared {
+            ring: Ring::new(self.capacity),
+            overflow: self.overflow,
+            emitted: AtomicUsize::new(0),
+            dropped: AtomicUsize::new(0),
+            sleeping: AtomicBool::new(false),
+            waiters: AtomicUsize::new(0),
+            shutdown: AtomicBool::new(false),
+            lock: Mutex::new(()),
+            wake: Condvar::new(),
+            progress: Condvar::new(),
+        });
+
+        let background = shared.clone();
+        let spawned = thread::Builder::new()
+            .name("oslog".into())
+            .spawn(move || background.run());
+
+        if spawned.is_err() {
+            self.failed.store(true, Ordering::Relaxed);
+            return None;
+        }
+
+        let started = Arc::into_raw(shared) as *mut Shared;
+
+        match self.shared.compare_exchange(
+            ptr::null_mut(),
+            started,
+            Ordering::AcqRel,
+            Ordering::Acquire,
+        ) {
+            Ok(_) => unsafe { started.as_ref() },
+            Err(current) => {
+                // Another thread started one first, so this one stops again.
+                let started = unsafe { Arc::from_raw(started) };
+                started.shutdown.store(true, Ordering::Release);
+                started.wake();
+                unsafe { current.as_ref() }
+            }
+        }
+    }
+
+    /// Queues the message, or drops it or waits for room if the queue is full
+    /// depending on the overflow policy. Returns false if it was dropped.
+    pub fn send(&self, message: Message) -> bool {
+        let shared = match self.shared() {
+            Some(shared) => shared,
+            None => {
+                emit_one(message);
+                return true;
+            }
+        };
+
+        let mut message = message;
+
+        while let Err(rejected) = shared.ring.push(message) {
+            match shared.overflow {
+                Overflow::Drop => {
+                    shared.dropped.fetch_add(1, Ordering::Relaxed);
+                    return false;
+                }
+                Overflow::Block => {
+                    message = rejected;
+                    shared.wake();
+
+                    // Any progress at all means there's room for another.
+                    let emitted = shared.emitted.load(Ordering::Acquire);
+                    shared.wait_until(|| shared.emitted.load(Ordering::Acquire) != emitted);
+                }
+            }
+        }
+
+        shared.wake();
+        true
+    }
+
+    /// Waits until every message sent before this was called has been output.
+    pub fn flush(&self) {
+        if let Some(shared) = self.current() {
+            let target = shared.ring.pushed();
+            shared.wake();
+            shared.wait_until(|| {
+                shared.emitted.load(Ordering::Acquire).wrapping_sub(target) as isize >= 0
+            });
+        }
+    }
+
+    /// The number of messages which were discarded because the queue was full.
+    #[cfg(test)]
+    pub fn dropped(&self) -> usize {
+        self.current()
+            .map_or(0, |shared| shared.dropped.load(Ordering::Relaxed))
+    }
+}
+
+impl Drop for Emitter {
+    fn drop(&mut self) {
+        // The thread outputs whatever is left in the queue before it exits.
+        if let Some(shared) = self.current() {
+            let shared = unsafe { Arc::from_raw(shared) };
+            shared.shutdown.store(true, Ordering::Release);
+            shared.wake();
+        }
+    }
+}
+
+impl Shared {
+    fn run(&self) {
+        let mut batch: Vec<Message> = Vec::with_capacity(MAX_BATCH_LEN);
+
+        loop {
+            let mut emitted = 0;
+
+            while let Some(message) = unsafe { self.ring.pop() } {
+                // Messages with a location are output on their own, since the
+                // batch call has no room for one.
+                let full = match batch.last() {
+                    Some(last) => {
+                        batch.len() == MAX_BATCH_LEN
+                            || !Arc::ptr_eq(&last.category, &message.category)
+                            || message.location.is_some()
+                    }
+                    None => false,
+                };
+
+                if full {
+                    emitted += emit(&mut batch);
+                }
+
+                if message.location.is_some() {
+                    emit_one(message);
+                    emitted += 1;
+                } else {
+                    batch.push(message);
+                }
+
+                if emitted >= PROGRESS_INTERVAL {
+                    self.progressed(emitted);
+                    emitted = 0;
+                }
+            }
+
+            emitted += emit(&mut batch);
+
+            if emitted > 0 {
+                self.progressed(emitted);
+            }
+
+            let guard = self.lock.lock().unwrap();
+            self.sleeping.store(true, Ordering::SeqCst);
+
+            // Pairs with the fence in `wake`, so either this sees the message
+            // or the sender sees that it has to wake this thread.
+            fence(Ordering::SeqCst);
+
+            if self.ring.pushed() != self.emitted.load(Ordering::Relaxed) {
+                self.sleeping.store(false, Ordering::Relaxed);
+                continue;
+            }
+
+            if self.shutdown.load(Ordering::Acquire) {
+                return;
+            }
+
+            drop(self.wake.wait(guard).unwrap());
+            self.sleeping.store(false, Ordering::Relaxed);
+        }
+    }
+
+    fn progressed(&self, emitted: usize) {
+        self.emitted.fetch_add(emitted, Ordering::Release);
+        fence(Ordering::SeqCst);
+
+        if self.waiters.load(Ordering::Relaxed) > 0 {
+            let _guard = self.lock.lock().unwrap();
+            self.progress.notify_all();
+        }
+    }
+
+    fn wake(&self) {
+        fence(Ordering::SeqCst);
+
+        if self.sleeping.load(Ordering::Relaxed) {
+            let _guard = self.lock.lock().unwrap();
+            self.wake.notify_one();
+        }
+    }
+
+    fn wait_until(&self, mut done: impl FnMut() -> bool) {
+        self.waiters.fetch_add(1, Ordering::SeqCst);
+        let mut guard = self.lock.lock().unwrap();
+
+        while !done() {
+            guard = self.progress.wait_timeout(guard, WAIT_TIMEOUT).unwrap().0;
+        }
+
+        drop(guard);
+        self.waiters.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+/// Outputs a single message.
+fn emit_one(message: Message) {
+    let log = &message.category.log;
+
+    match &message.location {
+        Some(location) => log.with_level_at(message.level, location, message.text.as_str()),
+        None => log.with_level(message.level, message.text.as_str()),
+    }
+}
+
+/// Outputs and clears a batch of messages which all have the same category,
+/// returning how many there were.
+fn emit(batch: &mut Vec<Message>) -> usize {
+    let len = batch.len();
+
+    if let Some(first) = batch.first() {
+        first
+            .category
+            .log
+            .with_level_batch_iter(batch.iter().map(|m| (m.level, m.text.as_str())));
+    }
+
+    batch.clear();
+    len
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::OsLog;
+
+    fn message(category: &Arc<Category>, text: &str) -> Message {
+        Message {
+            category: category.clone(),
+            level: Level::Default,
+            location: None,
+            text: Text::format(format_args!("{}", text)),
+        }
+    }
+
+    fn category() -> Arc<Category> {
+        Arc::new(Category::new(OsLog::new("com.example.oslog", "emitter")))
+    }
+
+    #[test]
+    fn test_flush() {
+        let category = category();
+        let emitter = Emitter::new(16);
+        emitter.flush();
+
+        for i in 0..100 {
+            emitter.send(message(&category, &i.to_string()));
+        }
+
+        emitter.flush();
+
+        // Every message has been output and dropped by the time flush returns.
+        assert_eq!(Arc::strong_count(&category), 1);
+    }
+
+    #[test]
+    fn test_block() {
+        let category = category();
+        let mut emitter = Emitter::new(2);
+        emitter.set_overflow(Overflow::Block);
+
+        std::thread::scope(|scope| {
+            for _ in 0..4 {
+                scope.spawn(|| {
+                    for _ in 0..250 {
+                        emitter.send(message(&category, "Block"));
+                    }
+                });
+            }
+        });
+
+        emitter.flush();
+        assert_eq!(emitter.dropped(), 0);
+        assert_eq!(Arc::strong_count(&category), 1);
+    }
+
+    #[test]
+    fn test_drop_policy() {
+        let category = category();
+        let emitter = Emitter::new(2);
+
+        for _ in 0..1000 {
+            emitter.send(message(&category, "Drop"));
+        }
+
+        emitter.flush();
+        assert!(emitter.dropped() < 1000);
+        assert_eq!(Arc::strong_count(&category), 1);
+    }
+}
@@ -0,0 +1,99 @@
+//! Keeps loggers and layers working in the children of `fork`, for pre-fork
+//! worker pools which set them up before forking.
+//!
+//! Only the forking thread exists in the child, so any lock another thread
+//! held at the time stays held forever, and the background thread is gone
+//! while whatever was queued for it is still queued in the parent too. Every
+//! live registry's lock is taken across the fork so they're all free in the
+//! child, and asynchronous loggers see the fork generation change and start
+//! over with an empty queue and a new thread the next time they're used,
+//! without touching any of the old state.
+
+use crate::registry::{Categories, Registry};
+use crate::sys::pthread_atfork;
+use std::cell::RefCell;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, MutexGuard, Once, PoisonError, RwLockWriteGuard, Weak};
+
+/// How many times this process is removed from the one which installed the
+/// logger.
+static GENERATION: AtomicUsize = AtomicUsize::new(0);
+
+/// Every registry created so far, including those which have since been
+/// dropped, until the next one is registered.
+static REGISTRIES: Mutex<Vec<Weak<Registry>>> = Mutex::new(Vec::new());
+
+/// The locks taken across a fork. The guards are declared first so they're
+/// dropped before the registries they borrow from.
+struct Locked {
+    guards: Vec<RwLockWriteGuard<'static, Categories>>,
+    registries: Vec<Arc<Registry>>,
+    _list: MutexGuard<'static, Vec<Weak<Registry>>>,
+}
+
+thread_local! {
+    /// Held by the forking thread from just before the fork until just after
+    /// it, in both processes.
+    static LOCKED: RefCell<Option<Locked>> = RefCell::new(None);
+}
+
+#[inline]
+pub(crate) fn generation() -> usize {
+    GENERATION.load(Ordering::Acquire)
+}
+
+/// Registers the registry of a logger or layer being created, so its lock is
+/// taken across forks, along with the fork handlers the first time.
+pub(crate) fn register(registry: &Arc<Registry>) {
+    static HANDLERS: Once = Once::new();
+
+    let mut registries = REGISTRIES.lock().unwrap_or_else(PoisonError::into_inner);
+    registries.retain(|registry| registry.strong_count() > 0);
+    registries.push(Arc::downgrade(registry));
+    drop(registries);
+
+    HANDLERS.call_once(|| unsafe {
+        pthread_atfork(Some(prepare), Some(parent), Some(child));
+    });
+}
+
+extern "C" fn prepare() {
+    let list = REGISTRIES.lock().unwrap_or_else(PoisonError::into_inner);
+    let registries: Vec<_> = list.iter().filter_map(Weak::upgrade).collect();
+
+    // Each guard borrows from an `Arc` which is kept alongside it, and dropped
+    // after it.
+    let guards = registries
+        .iter()
+        .map(|registry| unsafe { &*Arc::as_ptr(registry) }.lock_for_fork())
+        .collect();
+
+    let locked = Locked {
+        guards,
+        registries,
+        _list: list,
+    };
+
+    let _ = LOCKED.try_with(|slot| *slot.borrow_mut() = Some(locked));
+}
+
+extern "C" fn parent() {
+    let _ = LOCKED.try_with(|locked| locked.borrow_mut().take());
+}
+
+extern "C" fn child() {
+    let locked = LOCKED.try_with(|locked| locked.borrow_mut().take());
+    GENERATION.fetch_add(1, Ordering::Release);
+
+    // The child may well be configured to collect different levels.
+    if let Ok(Some(Locked {
+        guards, registries, ..
+    })) = locked
+    {
+        drop(guards);
+
+        for registry in registries {
+            registry.refresh();
+        }
+    }
+}
@@ -0,0 +1,847 @@
+//! Support for the `os_log!` macro, which passes a static format string and
+//! typed arguments to the OS instead of a preformatted message. The OS stores
+//! the arguments in a compact binary form and only formats them when the log
+//! is read.
+//!
+//! Everything here is an implementation detail of the macro. The format string
+//! is validated and rewritten at compile time, and each argument's type is
+//! checked against its conversion, so a mismatch fails the build rather than
+//! producing garbage in the log.
+
+use crate::signpost::SignpostId;
+use crate::sys::*;
+use crate::{Level, OsLog};
+use std::ffi::{CStr, CString};
+use std::marker::PhantomData;
+use std::os::raw::c_char;
+
+/// The section clang places os_log format strings in. The OS records where in
+/// the image the format is rather than copying it, so it has to live there.
+#[macro_export]
+#[doc(hidden)]
+macro_rules! __os_log_string {
+    ($name:ident, $len:expr, $value:expr) => {
+        #[cfg_attr(
+            target_vendor = "apple",
+            link_section = "__TEXT,__oslogstring,cstring_literals"
+        )]
+        static $name: [u8; $len] = $value;
+    };
+}
+
+/// Logs a message built from a static format string and typed arguments,
+/// which are encoded natively rather than being formatted up front.
+///
+/// The format string uses `printf` style conversions, as with the C `os_log`
+/// macros, where each conversion must match the type of its argument:
+///
+/// * `%d`, `%i`, `%u`, `%x`, `%o` and `%c` for integers of 32 bits or less.
+/// * `%ld`, `%lld`, `%zu` and so on for 64 bit and pointer sized integers.
+/// * `%f`, `%e`, `%g` and `%a` for floats.
+/// * `%s` for `str`, `String`, `CStr` and `CString`.
+/// * `%p` for raw pointers.
+///
+/// Conversions can be annotated with `{public}`, `{private}` or `{sensitive}`,
+/// as in `%{private}s`, and the OS redacts the argument accordingly when the
+/// log is read. Without an annotation strings are private and scalars are
+/// public. Other annotations, such as `{bool}`, are passed through untouched,
+/// except for `{mask.*}`, which takes an extra argument and isn't supported.
+///
+/// ```
+/// use oslog::{os_log, Level, OsLog};
+///
+/// let log = OsLog::new("com.example.test", "Parsing");
+/// let (name, count, elapsed) = ("config.toml", 12u32, 0.25);
+/// os_log!(log, Level::Info, "Parsed %s: %u items in %.2fs", name, count, elapsed);
+/// ```
+///
+/// Strings are passed with their length, so interior nul bytes end the string
+/// rather than being replaced. The format string must be in the same image as
+/// this crate, which is always the case unless it's built as its own dylib.
+#[macro_export]
+macro_rules! os_log {
+    ($log:expr, $level:expr, $format:literal $(, $arg:expr)* $(,)?) => {{
+        let log: &$crate::OsLog = &$log;
+        let level: $crate::Level = $level;
+
+        // Checked here as well, so compiled out levels fold away in the
+        // caller's crate even if `level_is_enabled` isn't inlined into it.
+        if level.is_statically_enabled() && log.level_is_enabled(level) {
+            $crate::__os_log_emit!($format, [$($arg),*], emit(log, level));
+        }
+    }};
+}
+
+/// Validates the format string, encodes the arguments and then calls the
+/// `Buffer` method given, passing the rewritten format string last.
+#[macro_export]
+#[doc(hidden)]
+macro_rules! __os_log_emit {
+    ($format:expr, [$($arg:expr),*], $method:ident($($method_arg:expr),*)) => {{
+        const FORMAT: &str = $format;
+        const COUNT: usize = $crate::format::argument_count(FORMAT);
+        #[allow(dead_code)]
+        const CLASSES: [$crate::format::ArgClass; COUNT] = $crate::format::classes(FORMAT);
+        #[allow(dead_code)]
+        const PRIVACY: [u8; COUNT] = $crate::format::privacy(FORMAT);
+        const _: () = assert!(
+            COUNT == <[()]>::len(&[$($crate::__os_log_unit!($arg)),*]),
+            "the number of arguments doesn't match the format string"
+        );
+        $crate::__os_log_string!(
+            REWRITTEN,
+            $crate::format::rewritten_len(FORMAT),
+            $crate::format::rewrite(FORMAT)
+        );
+
+        let mut storage = [0u8; $crate::format::buffer_len(COUNT)];
+
+        unsafe {
+            $crate::__os_log_encode!(
+                ($crate::format::Buffer::new(&mut storage)), (0), $($arg),*
+            )
+            .$method($($method_arg,)* &REWRITTEN);
+        }
+    }};
+}
+
+/// Pushes each argument in turn, checking it against the class of the
+/// conversion at the same index and marking it with that conversion's privacy
+/// annotation. The pushes are chained into one expression so any temporaries
+/// live until the buffer has been emitted.
+#[macro_export]
+#[doc(hidden)]
+macro_rules! __os_log_encode {
+    (($($buffer:tt)*), ($index:expr), ) => {
+        $($buffer)*
+    };
+    (($($buffer:tt)*), ($index:expr), $arg:expr $(, $rest:expr)*) => {
+        $crate::__os_log_encode!(
+            ($($buffer)*.push::<{ CLASSES[$index] as u8 }, { PRIVACY[$index] }, _>(&$arg)),
+            ($index + 1),
+            $($rest),*
+        )
+    };
+}
+
+#[macro_export]
+#[doc(hidden)]
+macro_rules! __os_log_unit {
+    ($arg:expr) => {
+        ()
+    };
+}
+
+/// The kind of argument a conversion expects.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u8)]
+pub enum ArgClass {
+    Int32,
+    Int64,
+    Double,
+    Str,
+    Pointer,
+}
+
+/// Item kinds, stored in the high nibble of each item's descriptor.
+const KIND_SCALAR: u8 = 0;
+const KIND_COUNT: u8 = 1;
+const KIND_STRING: u8 = 2;
+
+/// Privacy flags, stored in the low nibble of each item's descriptor. Without
+/// any the OS's default applies, which redacts strings but not scalars.
+const PRIVACY_PRIVATE: u8 = 1;
+pub(crate) const PRIVACY_PUBLIC: u8 = 1 << 1;
+const PRIVACY_SENSITIVE: u8 = 1 << 2 | PRIVACY_PRIVATE;
+
+/// Set in the buffer's summary byte when it contains private items.
+const SUMMARY_PRIVATE: u8 = 1;
+/// Set in the buffer's summary byte when it contains anything but scalars.
+const SUMMARY_NON_SCALAR: u8 = 1 << 1;
+
+/// The largest encoding of a single argument, which is a string's count and
+/// pointer items.
+const MAX_ARG_LEN: usize = 2 * 2 + 4 + 8;
+
+/// A single conversion in a format string.
+#[derive(Clone, Copy)]
+struct Conversion {
+    /// `None` for "%%".
+    class: Option<ArgClass>,
+    privacy: u8,
+    /// The index of the conversion character.
+    end: usize,
+}
+
+const fn word_is(format: &[u8], start: usize, end: usize, word: &[u8]) -> bool {
+    if end - start != word.len() {
+        return false;
+    }
+
+    let mut i = 0;
+
+    while i < word.len() {
+        if format[start + i] != word[i] {
+            return false;
+        }
+
+        i += 1;
+    }
+
+    true
+}
+
+const fn word_starts_with(format: &[u8], start: usize, end: usize, prefix: &[u8]) -> bool {
+    end - start >= prefix.len() && word_is(format, start, start + prefix.len(), prefix)
+}
+
+/// Parses an annotation such as `{public}` or `{private, bool}` which starts
+/// at `i`, returning its privacy flags and the index just past it. Anything
+/// but the privacy is left for the OS to interpret.
+const fn annotation(format: &[u8], mut i: usize) -> (u8, usize) {
+    let len = format.len();
+    let mut privacy = 0;
+    i += 1;
+
+    loop {
+        while i < len && format[i] == b' ' {
+            i += 1;
+        }
+
+        let start = i;
+
+        while i < len && !matches!(format[i], b',' | b'}' | b' ') {
+            i += 1;
+        }
+
+        let flags = if word_is(format, start, i, b"public") {
+            PRIVACY_PUBLIC
+        } else if word_is(format, start, i, b"private") {
+            PRIVACY_PRIVATE
+        } else if word_is(format, start, i, b"sensitive") {
+            PRIVACY_SENSITIVE
+        } else {
+            0
+        };
+
+        assert!(
+            flags == 0 || privacy == 0,
+            "conflicting privacy annotations in format string"
+        );
+        // Masks are passed as an extra argument before the value, which the
+        // argument classes and privacy bytes don't account for.
+        assert!(
+            !word_starts_with(format, start, i, b"mask."),
+            "mask annotations aren't supported in format strings"
+        );
+        privacy |= flags;
+
+        while i < len && format[i] == b' ' {
+            i += 1;
+        }
+
+        assert!(i < len, "unterminated annotation in format string");
+
+        if format[i] == b'}' {
+            return (privacy, i + 1);
+        }
+
+        i += 1;
+    }
+}
+
+/// Parses the conversion whose '%' is just before `i`.
+const fn conversion(format: &[u8], mut i: usize) -> Conversion {
+    let len = format.len();
+    let mut privacy = 0;
+
+    if i < len && format[i] == b'%' {
+        return Conversion {
+            class: None,
+            privacy,
+            end: i,
+        };
+    }
+
+    if i < len && format[i] == b'{' {
+        let (flags, end) = annotation(format, i);
+        privacy = flags;
+        i = end;
+    }
+
+    while i < len && matches!(format[i], b'-' | b'+' | b' ' | b'#' | b'0' | b'\'') {
+        i += 1;
+    }
+
+    while i < len && format[i].is_ascii_digit() {
+        i += 1;
+    }
+
+    let mut precision = false;
+
+    if i < len && format[i] == b'.' {
+        precision = true;
+        i += 1;
+
+        while i < len && format[i].is_ascii_digit() {
+            i += 1;
+        }
+    }
+
+    assert!(
+        i >= len || format[i] != b'*',
+        "`*` widths and precisions aren't supported in format strings"
+    );
+
+    let mut wide = false;
+
+    if i < len {
+        match format[i] {
+            b'h' => {
+                i += 1;
+
+                if i < len && format[i] == b'h' {
+                    i += 1;
+                }
+            }
+            b'l' => {
+                wide = true;
+                i += 1;
+
+                if i < len && format[i] == b'l' {
+                    i += 1;
+                }
+            }
+            b'j' | b'z' | b't' | b'q' => {
+                wide = true;
+                i += 1;
+            }
+            b'L' => panic!("long doubles aren't supported in format strings"),
+            _ => {}
+        }
+    }
+
+    assert!(
+        i < len,
+        "incomplete conversion at the end of the format string"
+    );
+
+    let class = match format[i] {
+        b'd' | b'i' | b'o' | b'u' | b'x' | b'X' => {
+            if wide {
+                ArgClass::Int64
+            } else {
+                ArgClass::Int32
+            }
+        }
+        b'c' => {
+            assert!(!wide, "wide characters aren't supported in format strings");
+            ArgClass::Int32
+        }
+        b'f' | b'F' | b'e' | b'E' | b'g' | b'G' | b'a' | b'A' => ArgClass::Double,
+        b's' => {
+            assert!(!wide, "wide strings aren't supported in format strings");
+            assert!(
+                !precision,
+                "string precisions aren't supported in format strings"
+            );
+            ArgClass::Str
+        }
+        b'p' => ArgClass::Pointer,
+        _ => panic!("unsupported conversion in format string"),
+    };
+
+    Conversion {
+        class: Some(class),
+        privacy,
+        end: i,
+    }
+}
+
+/// Returns the number of arguments the format string takes.
+pub const fn argument_count(format: &str) -> usize {
+    let format = format.as_bytes();
+    let mut count = 0;
+    let mut i = 0;
+
+    while i < format.len() {
+        assert!(format[i] != 0, "format strings can't contain nul bytes");
+
+        if format[i] == b'%' {
+            let conversion = conversion(format, i + 1);
+
+            if conversion.class.is_some() {
+                count += 1;
+            }
+
+            i = conversion.end;
+        }
+
+        i += 1;
+    }
+
+    count
+}
+
+/// Returns the class of each of the format string's `N` arguments.
+pub const fn classes<const N: usize>(format: &str) -> [ArgClass; N] {
+    let format = format.as_bytes();
+    let mut classes = [ArgClass::Int32; N];
+    let mut count = 0;
+    let mut i = 0;
+
+    while i < format.len() {
+        if format[i] == b'%' {
+            let conversion = conversion(format, i + 1);
+
+            if let Some(class) = conversion.class {
+                classes[count] = class;
+                count += 1;
+            }
+
+            i = conversion.end;
+        }
+
+        i += 1;
+    }
+
+    classes
+}
+
+/// Returns the privacy flags of each of the format string's `N` arguments.
+pub const fn privacy<const N: usize>(format: &str) -> [u8; N] {
+    let format = format.as_bytes();
+    let mut privacy = [0; N];
+    let mut count = 0;
+    let mut i = 0;
+
+    while i < format.len() {
+        if format[i] == b'%' {
+            let conversion = conversion(format, i + 1);
+
+            if conversion.class.is_some() {
+                privacy[count] = conversion.privacy;
+                count += 1;
+            }
+
+            i = conversion.end;
+        }
+
+        i += 1;
+    }
+
+    privacy
+}
+
+/// Returns the length of the rewritten format string, including its nul.
+pub const fn rewritten_len(format: &str) -> usize {
+    let bytes = format.as_bytes();
+    let strings = classes_of(bytes, ArgClass::Str);
+    bytes.len() + 2 * strings + 1
+}
+
+const fn classes_of(format: &[u8], wanted: ArgClass) -> usize {
+    let mut count = 0;
+    let mut i = 0;
+
+    while i < format.len() {
+        if format[i] == b'%' {
+            let conversion = conversion(format, i + 1);
+
+            if let Some(class) = conversion.class {
+                if class as u8 == wanted as u8 {
+                    count += 1;
+                }
+            }
+
+            i = conversion.end;
+        }
+
+        i += 1;
+    }
+
+    count
+}
+
+/// Rewrites each `%s` as `%.*s` so strings can be passed with their length
+/// rather than needing a nul terminated copy, and appends the nul terminator.
+pub const fn rewrite<const N: usize>(format: &str) -> [u8; N] {
+    let format = format.as_bytes();
+    let mut rewritten = [0u8; N];
+    let mut i = 0;
+    let mut j = 0;
+
+    while i < format.len() {
+        if format[i] == b'%' {
+            let conversion = conversion(format, i + 1);
+
+            while i < conversion.end {
+                rewritten[j] = format[i];
+                i += 1;
+                j += 1;
+            }
+
+            if let Some(ArgClass::Str) = conversion.class {
+                rewritten[j] = b'.';
+                rewritten[j + 1] = b'*';
+                j += 2;
+            }
+        }
+
+        rewritten[j] = format[i];
+        i += 1;
+        j += 1;
+    }
+
+    assert!(j + 1 == N, "rewritten format string has the wrong length");
+    rewritten
+}
+
+/// Appends a nul terminator to a string which is passed to the OS as is, such
+/// as a signpost's name.
+pub const fn terminate<const N: usize>(string: &str) -> [u8; N] {
+    let string = string.as_bytes();
+    let mut terminated = [0u8; N];
+    let mut i = 0;
+
+    assert!(
+        string.len() + 1 == N,
+        "terminated string has the wrong length"
+    );
+
+    while i < string.len() {
+        assert!(string[i] != 0, "static strings can't contain nul bytes");
+        terminated[i] = string[i];
+        i += 1;
+    }
+
+    terminated
+}
+
+/// Returns the size of the buffer needed for `count` arguments.
+pub const fn buffer_len(count: usize) -> usize {
+    // Strings take two items and the item count is a single byte.
+    assert!(count <= 127, "too many arguments for a single log message");
+    2 + count * MAX_ARG_LEN
+}
+
+/// The encoded arguments of a single message, in the layout which
+/// `_os_log_impl` expects: a summary byte, an item count, then each item's
+/// descriptor, size and data.
+pub struct Buffer<'a> {
+    bytes: &'a mut [u8],
+    len: usize,
+    /// The privacy flags of the argument being pushed.
+    privacy: u8,
+}
+
+impl<'a> Buffer<'a> {
+    pub fn new(bytes: &'a mut [u8]) -> Self {
+        bytes[0] = 0;
+        bytes[1] = 0;
+
+        Self {
+            bytes,
+            len: 2,
+            privacy: 0,
+        }
+    }
+
+    /// Appends an argument with the given privacy flags, failing to compile if
+    /// its type doesn't suit the class of its conversion.
+    #[inline]
+    pub fn push<const CLASS: u8, const PRIVACY: u8, T: OsLogArg + ?Sized>(
+        mut self,
+        arg: &'a T,
+    ) -> Self {
+        #[allow(clippy::let_unit_value)]
+        let () = Check::<CLASS, T>::MATCHES;
+
+        if PRIVACY & PRIVACY_PRIVATE != 0 {
+            self.bytes[0] |= SUMMARY_PRIVATE;
+        }
+
+        self.privacy = PRIVACY;
+        arg.encode(&mut self);
+        self
+    }
+
+    fn item(&mut self, kind: u8, data: &[u8]) {
+        self.item_with_privacy(kind, self.privacy, data);
+    }
+
+    fn item_with_privacy(&mut self, kind: u8, privacy: u8, data: &[u8]) {
+        self.bytes[1] += 1;
+        self.bytes[self.len] = kind << 4 | privacy;
+        self.bytes[self.len + 1] = data.len() as u8;
+        self.bytes[self.len + 2..self.len + 2 + data.len()].copy_from_slice(data);
+        self.len += 2 + data.len();
+    }
+
+    #[doc(hidden)]
+    pub fn scalar(&mut self, data: &[u8]) {
+        self.item(KIND_SCALAR, data);
+    }
+
+    /// Passes the string as a count and pointer, matching `%.*s`.
+    #[doc(hidden)]
+    pub fn string(&mut self, bytes: &'a [u8]) {
+        // An empty slice's pointer is dangling, so point at a terminator.
+        let pointer = if bytes.is_empty() {
+            b"\0".as_ptr()
+        } else {
+            bytes.as_ptr()
+        };
+
+        let len = bytes.len().min(i32::MAX as usize) as i32;
+
+        self.bytes[0] |= SUMMARY_NON_SCALAR;
+        // The privacy applies to the string rather than its length.
+        self.item_with_privacy(KIND_COUNT, 0, &len.to_ne_bytes());
+        self.item(KIND_STRING, &(pointer as usize).to_ne_bytes());
+    }
+
+    /// Logs the arguments with `format`.
+    ///
+    /// # Safety
+    ///
+    /// `format` must be nul terminated and stored in the `__oslogstring`
+    /// section, as `os_log!` does.
+    pub unsafe fn emit(self, log: &OsLog, level: Level, format: &'static [u8]) {
+        debug_assert_eq!(format.last(), Some(&0));
+
+        wrapped_os_log_impl(
+            log.inner,
+            level as u8,
+            format.as_ptr() as *const c_char,
+            self.bytes.as_mut_ptr(),
+            self.len as u32,
+        )
+    }
+
+    /// Emits a signpost with `name` and `format`.
+    ///
+    /// # Safety
+    ///
+    /// Both strings must be nul terminated and stored in the `__oslogstring`
+    /// section, as the signpost macros do.
+    pub unsafe fn emit_signpost(
+        self,
+        log: &OsLog,
+        kind: u8,
+        id: SignpostId,
+        name: &'static [u8],
+        format: &'static [u8],
+    ) {
+        debug_assert_eq!(name.last(), Some(&0));
+        debug_assert_eq!(format.last(), Some(&0));
+
+        wrapped_os_signpost_emit(
+            log.inner,
+            kind,
+            id.0,
+            name.as_ptr() as *const c_char,
+            format.as_ptr() as *const c_char,
+            self.bytes.as_mut_ptr(),
+            self.len as u32,
+        )
+    }
+}
+
+struct Check<const CLASS: u8, T: ?Sized>(PhantomData<T>);
+
+impl<const CLASS: u8, T: OsLogArg + ?Sized> Check<CLASS, T> {
+    const MATCHES: () = assert!(
+        T::CLASS as u8 == CLASS,
+        "an argument's type doesn't match its conversion in the format string"
+    );
+}
+
+/// A value which can be passed to `os_log!`.
+pub trait OsLogArg {
+    #[doc(hidden)]
+    const CLASS: ArgClass;
+
+    #[doc(hidden)]
+    fn encode<'a>(&'a self, buffer: &mut Buffer<'a>);
+}
+
+impl<T: OsLogArg + ?Sized> OsLogArg for &T {
+    const CLASS: ArgClass = T::CLASS;
+
+    #[inline]
+    fn encode<'a>(&'a self, buffer: &mut Buffer<'a>) {
+        (**self).encode(buffer)
+    }
+}
+
+macro_rules! impl_scalar {
+    ($class:ident, $as:ty, $($ty:ty),*) => {
+        $(
+            impl OsLogArg for $ty {
+                const CLASS: ArgClass = ArgClass::$class;
+
+                #[inline]
+                fn encode<'a>(&'a self, buffer: &mut Buffer<'a>) {
+                    buffer.scalar(&(*self as $as).to_ne_bytes())
+                }
+            }
+        )*
+    };
+}
+
+impl_scalar!(Int32, i32, i8, i16, i32, bool);
+impl_scalar!(Int32, u32, u8, u16, u32);
+impl_scalar!(Int64, i64, i64, isize);
+impl_scalar!(Int64, u64, u64, usize);
+impl_scalar!(Double, f64, f32, f64);
+
+impl<T: ?Sized> OsLogArg for *const T {
+    const CLASS: ArgClass = ArgClass::Pointer;
+
+    #[inline]
+    fn encode<'a>(&'a self, buffer: &mut Buffer<'a>) {
+        buffer.scalar(&(*self as *const () as usize).to_ne_bytes())
+    }
+}
+
+impl<T: ?Sized> OsLogArg for *mut T {
+    const CLASS: ArgClass = ArgClass::Pointer;
+
+    #[inline]
+    fn encode<'a>(&'a self, buffer: &mut Buffer<'a>) {
+        buffer.scalar(&(*self as *const () as usize).to_ne_bytes())
+    }
+}
+
+macro_rules! impl_string {
+    ($($ty:ty => $bytes:ident),*) => {
+        $(
+            impl OsLogArg for $ty {
+                const CLASS: ArgClass = ArgClass::Str;
+
+                #[inline]
+                fn encode<'a>(&'a self, buffer: &mut Buffer<'a>) {
+                    buffer.string(self.$bytes())
+                }
+            }
+        )*
+    };
+}
+
+impl_string!(str => as_bytes, String => as_bytes, CStr => to_bytes, CString => to_bytes);
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_argument_count() {
+        assert_eq!(argument_count("Nothing"), 0);
+        assert_eq!(argument_count("100%% done"), 0);
+        assert_eq!(argument_count("%d %s %{public}lld %-8.3f %p"), 5);
+    }
+
+    #[test]
+    fn test_classes() {
+        let classes: [ArgClass; 7] = classes("%d %hhu %lld %zu %.2f %{private}s %p");
+
+        assert_eq!(
+            classes,
+            [
+                ArgClass::Int32,
+                ArgClass::Int32,
+                ArgClass::Int64,
+                ArgClass::Int64,
+                ArgClass::Double,
+                ArgClass::Str,
+                ArgClass::Pointer,
+            ]
+        );
+    }
+
+    #[test]
+    fn test_privacy() {
+        let privacy: [u8; 6] =
+            privacy("%d %{public}s %{private}d %{ sensitive }s %{bool}d %{public, bool}d");
+
+        assert_eq!(
+            privacy,
+            [
+                0,
+                PRIVACY_PUBLIC,
+                PRIVACY_PRIVATE,
+                PRIVACY_SENSITIVE,
+                0,
+                PRIVACY_PUBLIC,
+            ]
+        );
+    }
+
+    #[test]
+    #[should_panic(expected = "mask annotations aren't supported")]
+    fn test_mask_annotation() {
+        argument_count("%{private, mask.hash}s");
+    }
+
+    #[test]
+    fn test_rewrite() {
+        const FORMAT: &str = "%s, %{public}8s and %d%%";
+        const LEN: usize = rewritten_len(FORMAT);
+        const REWRITTEN: [u8; LEN] = rewrite(FORMAT);
+
+        assert_eq!(&REWRITTEN, b"%.*s, %{public}8.*s and %d%%\0");
+    }
+
+    #[test]
+    fn test_encode_scalars() {
+        let mut storage = [0u8; 64];
+        let len = Buffer::new(&mut storage)
+            .push::<{ ArgClass::Int32 as u8 }, 0, _>(&-1i8)
+            .push::<{ ArgClass::Int64 as u8 }, PRIVACY_PUBLIC, _>(&2u64)
+            .push::<{ ArgClass::Double as u8 }, 0, _>(&0.5f32)
+            .len;
+
+        let mut expected = vec![0, 3];
+        expected.extend_from_slice(&[0, 4]);
+        expected.extend_from_slice(&(-1i32).to_ne_bytes());
+        expected.extend_from_slice(&[PRIVACY_PUBLIC, 8]);
+        expected.extend_from_slice(&2u64.to_ne_bytes());
+        expected.extend_from_slice(&[0, 8]);
+        expected.extend_from_slice(&0.5f64.to_ne_bytes());
+
+        assert_eq!(&storage[..len], &expected[..]);
+    }
+
+    #[test]
+    fn test_encode_string() {
+        let message = String::from("Hi");
+        let mut storage = [0u8; 64];
+        let len = Buffer::new(&mut storage)
+            .push::<{ ArgClass::Str as u8 }, PRIVACY_SENSITIVE, _>(&message)
+            .len;
+
+        let mut expected = vec![SUMMARY_PRIVATE | SUMMARY_NON_SCALAR, 2];
+        expected.extend_from_slice(&[0x10, 4]);
+        expected.extend_from_slice(&2i32.to_ne_bytes());
+        expected.extend_from_slice(&[0x20 | PRIVACY_SENSITIVE, 8]);
+        expected.extend_from_slice(&(message.as_ptr() as usize).to_ne_bytes());
+
+        assert_eq!(&storage[..len], &expected[..]);
+    }
+
+    #[test]
+    fn test_os_log() {
+        let log = OsLog::new("com.example.oslog", "format");
+        let owned = String::from("owned");
+        let cstr = CString::new("cstr").unwrap();
+
+        crate::os_log!(log, Level::Default, "No arguments");
+        crate::os_log!(log, Level::Default, "%d%% %u %lld", -1, 2u32, 3i64);
+        crate::os_log!(log, Level::Error, "%s %s %s", "static", owned, cstr);
+        crate::os_log!(log, Level::Error, "%{public}s %{private}s", "public", owned);
+        crate::os_log!(log, Level::Error, "%{sensitive}lld", 1i64);
+        crate::os_log!(log, Level::Fault, "%s", format!("{}", 1));
+        crate::os_log!(log, Level::Info, "%.3f %p", 0.5, &log as *const OsLog,);
+    }
+}
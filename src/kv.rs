@@ -0,0 +1,257 @@
+//! Passes the key-values attached to a record as native arguments rather than
+//! formatting them into its message. Keys are only known at run time, so each
+//! pair is passed as a key argument followed by its value, and there's a
+//! static format string for each combination of value types.
+
+use crate::format::{buffer_len, ArgClass, Buffer, PRIVACY_PUBLIC};
+use crate::{with_formatted, Level, OsLog};
+use log::kv::{Error, Key, Source, Value, VisitSource};
+use std::fmt;
+
+/// The most pairs which are passed natively. Records with more have them all
+/// formatted into the message instead.
+const MAX_PAIRS: usize = 4;
+
+const MESSAGE: &[u8] = b"%{public}.*s";
+const KEY: &[u8] = b" %{public}.*s=";
+const INT: &[u8] = b"%lld";
+const STR: &[u8] = b"%{public}.*s";
+
+/// The length of the format for `count` pairs, including its nul, where bit
+/// `i` of `ints` is set if the `i`th value is an integer.
+const fn format_len(count: usize, ints: usize) -> usize {
+    let mut len = MESSAGE.len() + 1;
+    let mut i = 0;
+
+    while i < count {
+        len += KEY.len();
+        len += if ints & 1 << i != 0 {
+            INT.len()
+        } else {
+            STR.len()
+        };
+        i += 1;
+    }
+
+    len
+}
+
+const fn append<const N: usize>(mut format: [u8; N], len: &mut usize, part: &[u8]) -> [u8; N] {
+    let mut i = 0;
+
+    while i < part.len() {
+        format[*len] = part[i];
+        *len += 1;
+        i += 1;
+    }
+
+    format
+}
+
+const fn format<const N: usize>(count: usize, ints: usize) -> [u8; N] {
+    let mut len = 0;
+    let mut format = append([0; N], &mut len, MESSAGE);
+    let mut i = 0;
+
+    while i < count {
+        format = append(format, &mut len, KEY);
+        format = if ints & 1 << i != 0 {
+            append(format, &mut len, INT)
+        } else {
+            append(format, &mut len, STR)
+        };
+        i += 1;
+    }
+
+    assert!(len + 1 == N, "key-value format has the wrong length");
+    format
+}
+
+/// The format for `count` pairs is at `(1 << count) - 2 + ints`.
+macro_rules! formats {
+    ($($count:literal: [$($ints:literal),*]),* $(,)?) => {
+        static FORMATS: [&[u8]; (1 << (MAX_PAIRS + 1)) - 2] = [$($({
+            crate::__os_log_string!(FORMAT, format_len($count, $ints), format($count, $ints));
+            &FORMAT
+        }),*),*];
+    };
+}
+
+formats! {
+    1: [0, 1],
+    2: [0, 1, 2, 3],
+    3: [0, 1, 2, 3, 4, 5, 6, 7],
+    4: [0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15],
+}
+
+#[derive(Clone, Copy)]
+enum Arg<'kvs> {
+    Int(i64),
+    Str(&'kvs str),
+}
+
+/// The pairs of a record, if they can all be passed natively.
+struct Pairs<'kvs> {
+    pairs: [(&'kvs str, Arg<'kvs>); MAX_PAIRS],
+    len: usize,
+}
+
+impl<'kvs> VisitSource<'kvs> for Pairs<'kvs> {
+    fn visit_pair(&mut self, key: Key<'kvs>, value: Value<'kvs>) -> Result<(), Error> {
+        let arg = match (value.to_i64(), value.to_borrowed_str()) {
+            (Some(value), _) => Arg::Int(value),
+            (None, Some(value)) => Arg::Str(value),
+            _ => return Err(Error::msg("value can't be passed natively")),
+        };
+
+        let key = key
+            .to_borrowed_str()
+            .ok_or_else(|| Error::msg("key can't be borrowed"))?;
+
+        if self.len == MAX_PAIRS {
+            return Err(Error::msg("too many pairs"));
+        }
+
+        self.pairs[self.len] = (key, arg);
+        self.len += 1;
+        Ok(())
+    }
+}
+
+/// Logs the message followed by the pairs as native arguments, returning
+/// false without logging anything if there are more than `MAX_PAIRS` of them
+/// or any value isn't an integer or a borrowed string.
+pub(crate) fn log_with_pairs(
+    log: &OsLog,
+    level: Level,
+    args: fmt::Arguments,
+    source: &dyn Source,
+) -> bool {
+    let mut pairs = Pairs {
+        pairs: [("", Arg::Int(0)); MAX_PAIRS],
+        len: 0,
+    };
+
+    if source.visit(&mut pairs).is_err() || pairs.len == 0 {
+        return false;
+    }
+
+    let pairs = &pairs.pairs[..pairs.len];
+    let ints = pairs
+        .iter()
+        .enumerate()
+        .fold(0, |ints, (i, (_, arg))| match arg {
+            Arg::Int(_) => ints | 1 << i,
+            Arg::Str(_) => ints,
+        });
+    let format = FORMATS[(1 << pairs.len()) - 2 + ints];
+
+    with_formatted(args, |message| {
+        let mut storage = [0u8; buffer_len(1 + 2 * MAX_PAIRS)];
+        let mut buffer =
+            Buffer::new(&mut storage).push::<{ ArgClass::Str as u8 }, PRIVACY_PUBLIC, _>(message);
+
+        for (key, arg) in pairs {
+            buffer = buffer.push::<{ ArgClass::Str as u8 }, PRIVACY_PUBLIC, str>(key);
+            buffer = match arg {
+                Arg::Int(value) => buffer.push::<{ ArgClass::Int64 as u8 }, 0, i64>(value),
+                Arg::Str(value) => {
+                    buffer.push::<{ ArgClass::Str as u8 }, PRIVACY_PUBLIC, str>(value)
+                }
+            };
+        }
+
+        // Safety: the format is one of the static ones above.
+        unsafe { buffer.emit(log, level, format) }
+    });
+
+    true
+}
+
+/// Displays the pairs as " key=value" each, for when they can't be passed
+/// natively.
+struct Formatted<'a>(&'a dyn Source);
+
+impl fmt::Display for Formatted<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        struct Writer<'a, 'b>(&'a mut fmt::Formatter<'b>);
+
+        impl<'kvs> VisitSource<'kvs> for Writer<'_, '_> {
+            fn visit_pair(&mut self, key: Key<'kvs>, value: Value<'kvs>) -> Result<(), Error> {
+                write!(self.0, " {}={}", key, value).map_err(Error::from)
+            }
+        }
+
+        self.0.visit(&mut Writer(f)).map_err(|_| fmt::Error)
+    }
+}
+
+/// Calls `f` with the message followed by the formatted pairs, or just the
+/// message if there are none, so its formatting isn't slowed down.
+pub(crate) fn with_pairs<R>(
+    args: fmt::Arguments,
+    source: &dyn Source,
+    f: impl FnOnce(fmt::Arguments) -> R,
+) -> R {
+    if source.count() == 0 {
+        f(args)
+    } else {
+        f(format_args!("{}{}", args, Formatted(source)))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const NO_PAIRS: [(&str, i64); 0] = [];
+
+    #[test]
+    fn test_formats() {
+        assert_eq!(FORMATS[0], b"%{public}.*s %{public}.*s=%{public}.*s\0");
+        assert_eq!(FORMATS[1], b"%{public}.*s %{public}.*s=%lld\0");
+        assert_eq!(
+            FORMATS[(1 << 3) - 2 + 0b101],
+            &b"%{public}.*s %{public}.*s=%lld %{public}.*s=%{public}.*s %{public}.*s=%lld\0"[..]
+        );
+        assert!(FORMATS.iter().all(|format| format.ends_with(b"\0")));
+    }
+
+    #[test]
+    fn test_log_with_pairs() {
+        let log = OsLog::new("com.example.oslog", "KeyValues");
+        let args = format_args!("Message");
+
+        assert!(log_with_pairs(&log, Level::Default, args, &[("count", 1)]));
+        assert!(log_with_pairs(
+            &log,
+            Level::Default,
+            args,
+            &[("first", "a"), ("second", "b")]
+        ));
+
+        // Floats and more than `MAX_PAIRS` pairs aren't passed natively.
+        assert!(!log_with_pairs(
+            &log,
+            Level::Default,
+            args,
+            &[("float", 1.5)]
+        ));
+        assert!(!log_with_pairs(&log, Level::Default, args, &[("n", 1); 5]));
+        assert!(!log_with_pairs(&log, Level::Default, args, &NO_PAIRS));
+    }
+
+    #[test]
+    fn test_with_pairs() {
+        let format = |source: &dyn Source| {
+            with_pairs(format_args!("Message"), source, |args| args.to_string())
+        };
+
+        assert_eq!(format(&NO_PAIRS), "Message");
+        assert_eq!(format(&[("count", 1)]), "Message count=1");
+        assert_eq!(
+            format(&[("float", 1.5), ("other", 2.0)]),
+            "Message float=1.5 other=2"
+        );
+    }
+}
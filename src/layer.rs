@@ -0,0 +1,587 @@
+use crate::fork;
+use crate::registry::{Category, Registry};
+use crate::routes::Routes;
+use crate::sys::{os_activity_scope_state_s, OS_SIGNPOST_INTERVAL_END};
+use crate::{static_level_filter, Level, OsActivity, OsLoggerHandle, SignpostId};
+use log::LevelFilter;
+use std::cell::RefCell;
+use std::fmt;
+use std::sync::Arc;
+use tracing_core::field::{Field, Visit};
+use tracing_core::span::{Attributes, Id};
+use tracing_core::subscriber::Interest;
+use tracing_core::{Event, Metadata, Subscriber};
+use tracing_subscriber::layer::{Context, Filter, Layer};
+use tracing_subscriber::registry::LookupSpan;
+
+crate::__os_signpost_name!(SPAN_NAME, "span");
+crate::__os_log_string!(EMPTY_FORMAT, 1, [0]);
+
+/// What spans are mapped to.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum SpanMode {
+    /// A signpost interval from when the span is created until it's closed,
+    /// named "span" with the span's name as its message. Costs next to nothing
+    /// unless signposts are being recorded.
+    Signposts,
+    /// An activity which is current while the span is entered, so the events
+    /// logged in it are grouped together. Each activity is described as
+    /// "span", since descriptions have to be static strings.
+    Activities,
+    /// Spans aren't mapped to anything.
+    Ignore,
+}
+
+/// A `tracing-subscriber` layer which logs events to the category named by
+/// their target, and maps spans to signposts or activities.
+///
+/// ```
+/// use oslog::OsLogLayer;
+/// use tracing_subscriber::layer::SubscriberExt;
+///
+/// let subscriber = tracing_subscriber::registry().with(OsLogLayer::new("com.example.test"));
+/// tracing::subscriber::with_default(subscriber, || {
+///     tracing::info!(target: "Parsing", items = 3, "Parsed");
+/// });
+/// ```
+///
+/// The layer doesn't disable anything by itself, since that would disable it
+/// for every other layer in the subscriber too. Events which won't be logged
+/// still reach it, and are dropped before they're formatted. To disable them
+/// up front for this layer only, filter it with its own `filter`:
+///
+/// ```
+/// use oslog::OsLogLayer;
+/// use tracing_subscriber::layer::SubscriberExt;
+/// use tracing_subscriber::Layer;
+///
+/// let layer = OsLogLayer::new("com.example.test");
+/// let filter = layer.filter();
+/// let subscriber = tracing_subscriber::registry().with(layer.with_filter(filter));
+/// ```
+pub struct OsLogLayer {
+    filter: OsLogFilter,
+    spans: SpanMode,
+}
+
+/// A per-layer filter which enables the events an `OsLogLayer` would log: at
+/// the levels allowed by their category's filter, or the layer's, and which
+/// the OS is collecting. Disabled callsites cost nothing for the filtered
+/// layer, while the other layers still see them. It's recalculated whenever
+/// the layer's handle changes a filter.
+#[derive(Clone)]
+pub struct OsLogFilter {
+    registry: Arc<Registry>,
+    routes: Arc<Routes>,
+}
+
+/// Stored in each span's extensions.
+struct SpanState {
+    category: Arc<Category>,
+    signpost: Option<SignpostId>,
+    activity: Option<OsActivity>,
+}
+
+thread_local! {
+    /// The activities entered by spans on this thread, innermost last.
+    static SCOPES: RefCell<Vec<(Id, os_activity_scope_state_s)>> = RefCell::new(Vec::new());
+}
+
+impl OsLogLayer {
+    /// Creates a layer which logs every level, and maps spans to signposts.
+    pub fn new(subsystem: &str) -> Self {
+        let registry = Arc::new(Registry::new());
+        fork::register(&registry);
+
+        Self::with_registry(registry, Arc::new(Routes::new(subsystem)))
+    }
+
+    pub(crate) fn with_registry(registry: Arc<Registry>, routes: Arc<Routes>) -> Self {
+        registry.track_interest();
+
+        Self {
+            filter: OsLogFilter { registry, routes },
+            spans: SpanMode::Signposts,
+        }
+    }
+
+    /// Creates the categories of targets starting with `prefix` in
+    /// `subsystem`, as `OsLogger::subsystem_for` does.
+    pub fn subsystem_for(mut self, prefix: &str, subsystem: &str) -> Self {
+        Arc::make_mut(&mut self.filter.routes).insert(prefix, subsystem);
+        self
+    }
+
+    /// Only levels at or above `level` will be logged, for categories without
+    /// their own filter. A layer created by a logger's handle shares the
+    /// logger's level filter.
+    pub fn level_filter(self, level: LevelFilter) -> Self {
+        self.handle().set_level_filter(level);
+        self
+    }
+
+    /// Sets or updates the category's level filter.
+    pub fn category_level_filter(self, category: &str, level: LevelFilter) -> Self {
+        self.handle().set_category_level_filter(category, level);
+        self
+    }
+
+    /// Keeps at most `max` categories, as `OsLogger::max_categories` does.
+    pub fn max_categories(self, max: usize) -> Self {
+        self.filter.registry.set_capacity(max);
+        self
+    }
+
+    /// Sets what spans are mapped to.
+    pub fn spans(self, spans: SpanMode) -> Self {
+        Self { spans, ..self }
+    }
+
+    /// Returns a handle which changes the layer's filters while it's in use.
+    pub fn handle(&self) -> OsLoggerHandle {
+        OsLoggerHandle::new(self.filter.registry.clone(), self.filter.routes.clone())
+    }
+
+    /// Returns a filter which disables the events this layer wouldn't log,
+    /// for this layer only. It shares the layer's categories and filters.
+    pub fn filter(&self) -> OsLogFilter {
+        self.filter.clone()
+    }
+}
+
+impl OsLogFilter {
+    fn category(&self, target: &str) -> Arc<Category> {
+        self.registry.with(target, |category| match category {
+            Some(category) => category.clone(),
+            None => self
+                .registry
+                .get_or_insert(target, |name| self.routes.log(name)),
+        })
+    }
+
+    #[inline]
+    fn is_enabled(&self, category: &Category, level: log::Level, epoch: u64) -> bool {
+        category.is_enabled(level, epoch, &self.registry)
+    }
+
+    /// Whether events from the callsite would be logged, creating its
+    /// category if needed. Spans always are.
+    ///
+    /// This is called while `tracing` holds the lock on its callsites, so it
+    /// doesn't move the epoch on, which could rebuild their interest.
+    fn is_callsite_enabled(&self, metadata: &Metadata<'_>) -> bool {
+        if metadata.is_span() {
+            return true;
+        }
+
+        let level = log_level(metadata.level());
+        let epoch = self.registry.current_epoch();
+
+        level <= static_level_filter()
+            && self.is_enabled(&self.category(metadata.target()), level, epoch)
+    }
+
+    /// Like `is_callsite_enabled`, but without creating a category.
+    fn is_event_enabled(&self, metadata: &Metadata<'_>) -> bool {
+        if metadata.is_span() {
+            return true;
+        }
+
+        let level = log_level(metadata.level());
+
+        if level > static_level_filter() {
+            return false;
+        }
+
+        let epoch = self.registry.epoch();
+
+        self.registry
+            .with(metadata.target(), |category| match category {
+                Some(category) => self.is_enabled(category, level, epoch),
+                None => level <= self.registry.level(),
+            })
+    }
+}
+
+impl<S> Filter<S> for OsLogFilter {
+    /// Called once per callsite, so events which wouldn't be logged are
+    /// disabled up front and cost nothing from then on. The interest is
+    /// recalculated when a handle changes a filter, and when the levels the
+    /// OS collects are found to have changed, which is checked every refresh
+    /// interval while events are being logged.
+    fn callsite_enabled(&self, metadata: &'static Metadata<'static>) -> Interest {
+        if self.is_callsite_enabled(metadata) {
+            Interest::always()
+        } else {
+            Interest::never()
+        }
+    }
+
+    fn enabled(&self, metadata: &Metadata<'_>, _: &Context<'_, S>) -> bool {
+        self.is_event_enabled(metadata)
+    }
+
+    fn max_level_hint(&self) -> Option<tracing_core::LevelFilter> {
+        Some(match static_level_filter() {
+            LevelFilter::Off => tracing_core::LevelFilter::OFF,
+            LevelFilter::Error => tracing_core::LevelFilter::ERROR,
+            LevelFilter::Warn => tracing_core::LevelFilter::WARN,
+            LevelFilter::Info => tracing_core::LevelFilter::INFO,
+            LevelFilter::Debug => tracing_core::LevelFilter::DEBUG,
+            LevelFilter::Trace => tracing_core::LevelFilter::TRACE,
+        })
+    }
+}
+
+fn log_level(level: &tracing_core::Level) -> log::Level {
+    match *level {
+        tracing_core::Level::TRACE => log::Level::Trace,
+        tracing_core::Level::DEBUG => log::Level::Debug,
+        tracing_core::Level::INFO => log::Level::Info,
+        tracing_core::Level::WARN => log::Level::Warn,
+        _ => log::Level::Error,
+    }
+}
+
+impl<S> Layer<S> for OsLogLayer
+where
+    S: Subscriber + for<'a> LookupSpan<'a>,
+{
+    /// Callsites which wouldn't be logged are only marked as sometimes
+    /// interesting, rather than never, so they stay enabled for the other
+    /// layers and are dropped in `on_event`.
+    fn register_callsite(&self, metadata: &'static Metadata<'static>) -> Interest {
+        if self.filter.is_callsite_enabled(metadata) {
+            Interest::always()
+        } else {
+            Interest::sometimes()
+        }
+    }
+
+    fn on_event(&self, event: &Event<'_>, _: Context<'_, S>) {
+        let metadata = event.metadata();
+        let level = log_level(metadata.level());
+
+        if level > static_level_filter() {
+            return;
+        }
+
+        let epoch = self.filter.registry.epoch();
+
+        self.filter.registry.with(metadata.target(), |category| {
+            let created;
+            let category = match category {
+                Some(category) => category,
+                None => {
+                    created = self.filter.category(metadata.target());
+                    &created
+                }
+            };
+
+            if self.filter.is_enabled(category, level, epoch) {
+                let level: Level = level.into();
+                category
+                    .log
+                    .with_level_args(level, format_args!("{}", Fields(event)));
+            }
+        });
+    }
+
+    fn on_new_span(&self, attributes: &Attributes<'_>, id: &Id, ctx: Context<'_, S>) {
+        if self.spans == SpanMode::Ignore {
+            return;
+        }
+
+        let span = match ctx.span(id) {
+            Some(span) => span,
+            None => return,
+        };
+
+        let category = self.filter.category(attributes.metadata().target());
+        let log = &category.log;
+        let mut state = SpanState {
+            signpost: None,
+            activity: None,
+            category: category.clone(),
+        };
+
+        match self.spans {
+            SpanMode::Signposts if log.signposts_enabled() => {
+                let id = SignpostId::generate(log);
+                let name = attributes.metadata().name();
+
+                crate::__os_log_emit!(
+                    "%{public}s",
+                    [name],
+                    emit_signpost(log, crate::sys::OS_SIGNPOST_INTERVAL_BEGIN, id, &SPAN_NAME)
+                );
+
+                state.signpost = Some(id);
+            }
+            SpanMode::Activities => state.activity = Some(crate::os_activity!("span")),
+            _ => {}
+        }
+
+        span.extensions_mut().insert(state);
+    }
+
+    fn on_enter(&self, id: &Id, ctx: Context<'_, S>) {
+        let span = match ctx.span(id) {
+            Some(span) => span,
+            None => return,
+        };
+
+        let extensions = span.extensions();
+        let scope = extensions
+            .get::<SpanState>()
+            .and_then(|state| state.activity.as_ref())
+            .and_then(OsActivity::scope_enter);
+
+        if let Some(scope) = scope {
+            let pushed = SCOPES.try_with(|scopes| scopes.borrow_mut().push((id.clone(), scope)));
+
+            // While the thread is being torn down there's nowhere to keep it
+            // for `on_exit`, so it's left straight away.
+            if pushed.is_err() {
+                unsafe { OsActivity::scope_leave(scope) }
+            }
+        }
+    }
+
+    fn on_exit(&self, id: &Id, _: Context<'_, S>) {
+        let _ = SCOPES.try_with(|scopes| {
+            let mut scopes = scopes.borrow_mut();
+
+            if scopes.last().map_or(false, |(entered, _)| entered == id) {
+                let (_, scope) = scopes.pop().unwrap();
+                unsafe { OsActivity::scope_leave(scope) }
+            }
+        });
+    }
+
+    fn on_close(&self, id: Id, ctx: Context<'_, S>) {
+        let span = match ctx.span(&id) {
+            Some(span) => span,
+            None => return,
+        };
+
+        let mut extensions = span.extensions_mut();
+
+        if let Some(SpanState {
+            category,
+            signpost: Some(signpost),
+            ..
+        }) = extensions.remove::<SpanState>()
+        {
+            let mut storage = [0u8; 2];
+
+            unsafe {
+                crate::format::Buffer::new(&mut storage).emit_signpost(
+                    &category.log,
+                    OS_SIGNPOST_INTERVAL_END,
+                    signpost,
+                    &SPAN_NAME,
+                    &EMPTY_FORMAT,
+                )
+            }
+        }
+    }
+}
+
+/// Formats an event's message followed by its other fields as `name=value`.
+struct Fields<'a>(&'a Event<'a>);
+
+impl fmt::Display for Fields<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        let mut visitor = FieldWriter {
+            f,
+            first: true,
+            result: Ok(()),
+        };
+
+        self.0.record(&mut visitor);
+        visitor.result
+    }
+}
+
+struct FieldWriter<'a, 'b> {
+    f: &'a mut fmt::Formatter<'b>,
+    first: bool,
+    result: fmt::Result,
+}
+
+impl FieldWriter<'_, '_> {
+    fn write(&mut self, field: &Field, value: &dyn fmt::Display) {
+        if self.result.is_err() {
+            return;
+        }
+
+        let separator = if self.first { "" } else { " " };
+        self.first = false;
+
+        self.result = if field.name() == "message" {
+            write!(self.f, "{}{}", separator, value)
+        } else {
+            write!(self.f, "{}{}={}", separator, field.name(), value)
+        };
+    }
+}
+
+impl Visit for FieldWriter<'_, '_> {
+    fn record_str(&mut self, field: &Field, value: &str) {
+        self.write(field, &value)
+    }
+
+    fn record_debug(&mut self, field: &Field, value: &dyn fmt::Debug) {
+        self.write(field, &format_args!("{:?}", value))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use tracing_subscriber::layer::SubscriberExt;
+
+    fn with_layer(layer: OsLogLayer, f: impl FnOnce()) {
+        tracing::subscriber::with_default(tracing_subscriber::registry().with(layer), f);
+    }
+
+    #[test]
+    fn test_fields() {
+        use std::sync::Mutex;
+
+        /// Records how the layer formats each event.
+        struct Capture(Arc<Mutex<Vec<String>>>);
+
+        impl<S: Subscriber> Layer<S> for Capture {
+            fn on_event(&self, event: &Event<'_>, _: Context<'_, S>) {
+                self.0.lock().unwrap().push(Fields(event).to_string());
+            }
+        }
+
+        let layer = OsLogLayer::new("com.example.oslog");
+        let registry = layer.filter.registry.clone();
+        let captured = Arc::new(Mutex::new(Vec::new()));
+        let subscriber = tracing_subscriber::registry()
+            .with(layer)
+            .with(Capture(captured.clone()));
+
+        tracing::subscriber::with_default(subscriber, || {
+            let value = 1;
+            tracing::info!(target: "Fields", value, name = "test", "Message {}", value);
+            tracing::warn!(target: "Fields", "Static");
+        });
+
+        assert!(registry.with("Fields", |category| category.is_some()));
+        assert_eq!(
+            *captured.lock().unwrap(),
+            ["Message 1 value=1 name=test", "Static"]
+        );
+    }
+
+    #[test]
+    fn test_category_filter() {
+        use tracing_subscriber::Layer;
+
+        let layer = OsLogLayer::new("com.example.oslog")
+            .category_level_filter("Filtered", LevelFilter::Warn);
+        let handle = layer.handle();
+        let filter = layer.filter();
+        let subscriber = tracing_subscriber::registry().with(layer.with_filter(filter));
+
+        tracing::subscriber::with_default(subscriber, || {
+            let filtered = || tracing::enabled!(target: "Filtered", tracing::Level::INFO);
+            assert!(!filtered());
+
+            // Handles rebuild the interest cache, so callsites see the change.
+            handle.set_category_level_filter("Filtered", LevelFilter::Trace);
+            assert!(filtered());
+        });
+    }
+
+    #[test]
+    fn test_level_filter() {
+        use tracing_subscriber::Layer;
+
+        let layer = OsLogLayer::new("com.example.oslog").level_filter(LevelFilter::Warn);
+        let handle = layer.handle();
+        let filter = layer.filter();
+        let subscriber = tracing_subscriber::registry().with(layer.with_filter(filter));
+
+        tracing::subscriber::with_default(subscriber, || {
+            let enabled = || tracing::enabled!(target: "Default", tracing::Level::INFO);
+            assert!(!enabled());
+
+            handle.set_level_filter(LevelFilter::Info);
+            assert!(enabled());
+
+            handle.set_level_filter(LevelFilter::Error);
+            assert!(!enabled());
+        });
+    }
+
+    #[test]
+    fn test_other_layers() {
+        use std::sync::atomic::{AtomicUsize, Ordering};
+        use tracing_subscriber::Layer;
+
+        struct Count(Arc<AtomicUsize>);
+
+        impl<S: Subscriber> Layer<S> for Count {
+            fn on_event(&self, _: &Event<'_>, _: Context<'_, S>) {
+                self.0.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+
+        // Neither event is logged, since the OS isn't collecting debug
+        // records and the category filters out info, but the other layer
+        // sees both either way.
+        fn count(layer: impl Layer<tracing_subscriber::Registry> + Send + Sync) -> usize {
+            let count = Arc::new(AtomicUsize::new(0));
+            let subscriber = tracing_subscriber::registry()
+                .with(layer)
+                .with(Count(count.clone()));
+
+            tracing::subscriber::with_default(subscriber, || {
+                tracing::debug!(target: "Other", "Debug");
+                tracing::info!(target: "Filtered", "Info");
+            });
+
+            count.load(Ordering::Relaxed)
+        }
+
+        let layer = || {
+            OsLogLayer::new("com.example.oslog")
+                .category_level_filter("Filtered", LevelFilter::Warn)
+        };
+
+        assert_eq!(count(layer()), 2);
+
+        let filtered = layer();
+        let filter = filtered.filter();
+        assert_eq!(count(filtered.with_filter(filter)), 2);
+    }
+
+    #[test]
+    fn test_spans() {
+        for mode in [SpanMode::Signposts, SpanMode::Activities, SpanMode::Ignore] {
+            with_layer(OsLogLayer::new("com.example.oslog").spans(mode), || {
+                let previous = OsActivity::current_id();
+                let span = tracing::info_span!(target: "Spans", "Outer", value = 1);
+
+                {
+                    let _entered = span.enter();
+                    let inner = tracing::info_span!(target: "Spans", "Inner");
+                    let _inner = inner.enter();
+                    tracing::info!(target: "Spans", "Inside");
+
+                    if mode == SpanMode::Activities {
+                        assert_ne!(OsActivity::current_id(), previous);
+                    }
+                }
+
+                assert_eq!(OsActivity::current_id(), previous);
+            });
+        }
+    }
+}
@@ -1,21 +1,235 @@
+mod activity;
 mod sys;
 
+#[cfg(test)]
+mod counting;
+
+#[doc(hidden)]
+pub mod format;
+
+#[cfg(feature = "logger")]
+mod arena;
+
+#[cfg(feature = "logger")]
+mod emitter;
+
+#[cfg(feature = "logger")]
+mod fork;
+
+#[cfg(feature = "logger")]
+mod kv;
+
+#[cfg(feature = "tracing")]
+mod layer;
+
+#[cfg(feature = "logger")]
+mod limiter;
+
 #[cfg(feature = "logger")]
 mod logger;
 
 #[cfg(feature = "logger")]
-pub use logger::OsLogger;
+mod registry;
+
+#[cfg(feature = "logger")]
+mod ring;
+
+#[cfg(feature = "logger")]
+mod routes;
+
+#[cfg(feature = "logger")]
+mod sampler;
+
+#[cfg(feature = "logger")]
+mod stats;
+
+mod signpost;
+
+#[cfg(feature = "logger")]
+pub use emitter::Overflow;
+
+#[cfg(feature = "tracing")]
+pub use layer::{OsLogFilter, OsLogLayer, SpanMode};
+
+#[cfg(feature = "logger")]
+pub use limiter::RateLimit;
+
+#[cfg(feature = "logger")]
+pub use logger::{OsLogger, OsLoggerHandle};
+
+#[cfg(feature = "logger")]
+pub use sampler::Sampling;
+
+#[cfg(feature = "logger")]
+pub use stats::CategoryStats;
+
+pub use activity::{ActivityFlags, ActivityScope, OsActivity};
+pub use signpost::{SignpostId, SignpostInterval};
 
 use crate::sys::*;
-use std::ffi::{c_void, CString};
+use std::cell::RefCell;
+use std::ffi::{c_void, CStr, CString};
+use std::fmt::{self, Write};
+use std::os::raw::{c_char, c_int};
+use std::ptr;
+
+/// Messages shorter than this are copied to the stack rather than the heap.
+const STACK_BUFFER_LEN: usize = 256;
+
+/// Thread local buffers which grow beyond this are released after use, so a
+/// single huge message doesn't pin the memory for the life of the thread.
+const MAX_RETAINED_BUFFER_LEN: usize = 16 * 1024;
+
+/// How many messages `with_level_batch` hands to the OS per call.
+const BATCH_LEN: usize = 32;
+
+thread_local! {
+    /// Reused by `with_level_args` to format messages without allocating.
+    static BUFFER: RefCell<Vec<u8>> = RefCell::new(Vec::new());
+}
 
 #[inline]
 fn to_cstr(message: &str) -> CString {
-    let fixed = message.replace('\0', "(null)");
-    CString::new(fixed).unwrap()
+    // `contains` on a byte slice is backed by memchr.
+    let bytes = if message.as_bytes().contains(&0) {
+        message.replace('\0', "(null)").into_bytes()
+    } else {
+        // Room for the nul, so adding it doesn't reallocate.
+        let mut bytes = Vec::with_capacity(message.len() + 1);
+        bytes.extend_from_slice(message.as_bytes());
+        bytes
+    };
+
+    // Safety: interior nul bytes were replaced above.
+    unsafe { CString::from_vec_unchecked(bytes) }
+}
+
+/// Calls `f` with a nul terminated copy of `message`. Short messages without
+/// interior nul bytes, which are the vast majority, are copied to the stack
+/// and only the rest go through `to_cstr`.
+#[inline]
+fn with_cstr<R>(message: &str, f: impl FnOnce(&CStr) -> R) -> R {
+    let bytes = message.as_bytes();
+
+    if bytes.len() >= STACK_BUFFER_LEN || bytes.contains(&0) {
+        return f(&to_cstr(message));
+    }
+
+    let mut buffer = [0u8; STACK_BUFFER_LEN];
+    buffer[..bytes.len()].copy_from_slice(bytes);
+
+    // Safety: the buffer is zeroed past the end of the message, and the
+    // message was checked for interior nul bytes above.
+    f(unsafe { CStr::from_bytes_with_nul_unchecked(&buffer[..=bytes.len()]) })
+}
+
+/// Calls `f` with the formatted message, without nul bytes and terminated.
+/// Messages are formatted into a reused thread local buffer, so no allocation
+/// is made per message.
+fn with_formatted<R>(args: fmt::Arguments, f: impl FnOnce(&CStr) -> R) -> R {
+    if let Some(message) = args.as_str() {
+        return with_cstr(message, f);
+    }
+
+    let mut f = Some(f);
+
+    let result = BUFFER
+        .try_with(|buffer| {
+            // Fails if a Display implementation being formatted logs too.
+            let mut buffer = buffer.try_borrow_mut().ok()?;
+
+            buffer.clear();
+            // An error can only come from a Display implementation, in which
+            // case whatever was written before it is still logged.
+            let _ = CStrWriter(&mut buffer).write_fmt(args);
+            buffer.push(0);
+
+            // Safety: CStrWriter replaced any nul bytes.
+            let message = unsafe { CStr::from_bytes_with_nul_unchecked(&buffer) };
+            let result = f.take().map(|f| f(message));
+
+            if buffer.capacity() > MAX_RETAINED_BUFFER_LEN {
+                *buffer = Vec::new();
+            }
+
+            result
+        })
+        .ok()
+        .flatten();
+
+    match result {
+        Some(result) => result,
+        None => with_cstr(&args.to_string(), f.take().unwrap()),
+    }
+}
+
+/// Where a message was logged from.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Location<'a> {
+    pub file: &'a str,
+    pub line: u32,
+    pub module_path: &'a str,
+}
+
+#[doc(hidden)]
+pub mod __private {
+    pub use crate::sys::{OS_SIGNPOST_EVENT, OS_SIGNPOST_INTERVAL_BEGIN};
+    pub use std::sync::OnceLock;
+}
+
+/// Evaluates to a `&'static OsLog` for the subsystem and category, which is
+/// created the first time the call site runs and reused from then on.
+///
+/// ```
+/// let log = oslog::oslog_category!("com.example.test", "Parsing");
+/// log.debug("Parsed");
+/// ```
+#[macro_export]
+macro_rules! oslog_category {
+    ($subsystem:expr, $category:expr $(,)?) => {{
+        static LOG: $crate::__private::OnceLock<$crate::OsLog> = $crate::__private::OnceLock::new();
+        LOG.get_or_init(|| $crate::OsLog::new($subsystem, $category))
+    }};
+}
+
+/// Evaluates to a nul terminated `&'static CStr` for a string literal, for
+/// `OsLog::with_level_cstr`. Nul bytes in the literal fail to compile.
+///
+/// ```
+/// use oslog::{os_log_cstr, Level, OsLog};
+///
+/// let log = OsLog::new("com.example.test", "Requests");
+/// log.with_level_cstr(Level::Info, os_log_cstr!("Started"));
+/// ```
+#[macro_export]
+macro_rules! os_log_cstr {
+    ($message:literal $(,)?) => {{
+        static MESSAGE: [u8; $message.len() + 1] = $crate::format::terminate($message);
+        // Safety: `terminate` checked for interior nul bytes and appended one.
+        unsafe { ::std::ffi::CStr::from_bytes_with_nul_unchecked(&MESSAGE) }
+    }};
+}
+
+/// Formats into a byte buffer, replacing interior nul bytes with "(null)" as
+/// they are written so the result can be terminated and used as a C string.
+struct CStrWriter<'a>(&'a mut Vec<u8>);
+
+impl Write for CStrWriter<'_> {
+    fn write_str(&mut self, s: &str) -> fmt::Result {
+        for (i, part) in s.split('\0').enumerate() {
+            if i > 0 {
+                self.0.extend_from_slice(b"(null)");
+            }
+
+            self.0.extend_from_slice(part.as_bytes());
+        }
+
+        Ok(())
+    }
 }
 
 #[repr(u8)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
 pub enum Level {
     Debug = OS_LOG_TYPE_DEBUG,
     Info = OS_LOG_TYPE_INFO,
@@ -24,6 +238,73 @@ pub enum Level {
     Fault = OS_LOG_TYPE_FAULT,
 }
 
+/// How verbose the most verbose level which is compiled in is, from 0 for
+/// none of them up to 5 for all of them, as set by the `max_level_*` and
+/// `release_max_level_*` features.
+const STATIC_MAX_VERBOSITY: u8 = if cfg!(any(
+    feature = "max_level_off",
+    all(not(debug_assertions), feature = "release_max_level_off")
+)) {
+    0
+} else if cfg!(any(
+    feature = "max_level_fault",
+    all(not(debug_assertions), feature = "release_max_level_fault")
+)) {
+    1
+} else if cfg!(any(
+    feature = "max_level_error",
+    all(not(debug_assertions), feature = "release_max_level_error")
+)) {
+    2
+} else if cfg!(any(
+    feature = "max_level_default",
+    all(not(debug_assertions), feature = "release_max_level_default")
+)) {
+    3
+} else if cfg!(any(
+    feature = "max_level_info",
+    all(not(debug_assertions), feature = "release_max_level_info")
+)) {
+    4
+} else {
+    5
+};
+
+impl Level {
+    /// Orders levels from the least verbose, `Fault`, to the most, `Debug`,
+    /// unlike their OS values.
+    const fn verbosity(self) -> u8 {
+        match self {
+            Level::Fault => 1,
+            Level::Error => 2,
+            Level::Default => 3,
+            Level::Info => 4,
+            Level::Debug => 5,
+        }
+    }
+
+    /// Whether messages at this level are compiled in, rather than removed
+    /// by one of the `max_level_*` features. Everything which logs through
+    /// `OsLog` checks this first, so it folds away with a constant level.
+    #[inline(always)]
+    pub const fn is_statically_enabled(self) -> bool {
+        self.verbosity() <= STATIC_MAX_VERBOSITY
+    }
+}
+
+/// The `log` crate's filter equivalent to the static max level.
+#[cfg(feature = "logger")]
+pub(crate) fn static_level_filter() -> log::LevelFilter {
+    match STATIC_MAX_VERBOSITY {
+        0 => log::LevelFilter::Off,
+        1 => log::LevelFilter::Error,
+        2 => log::LevelFilter::Warn,
+        3 => log::LevelFilter::Info,
+        4 => log::LevelFilter::Debug,
+        _ => log::LevelFilter::Trace,
+    }
+}
+
 #[cfg(feature = "logger")]
 impl From<log::Level> for Level {
     fn from(other: log::Level) -> Self {
@@ -74,38 +355,178 @@ impl OsLog {
         Self { inner }
     }
 
+    #[inline]
     pub fn with_level(&self, level: Level, message: &str) {
-        let message = to_cstr(message);
+        if !level.is_statically_enabled() {
+            return;
+        }
+
+        with_cstr(message, |message| unsafe {
+            wrapped_os_log_with_type(self.inner, level as u8, message.as_ptr())
+        })
+    }
+
+    /// Like `with_level`, for a message which is already nul terminated, so
+    /// it's neither scanned nor copied. Constant messages can use
+    /// `os_log_cstr!`, or `c"..."` literals on newer editions.
+    #[inline]
+    pub fn with_level_cstr(&self, level: Level, message: &CStr) {
+        if !level.is_statically_enabled() {
+            return;
+        }
+
         unsafe { wrapped_os_log_with_type(self.inner, level as u8, message.as_ptr()) }
     }
 
+    /// Formats `args` straight into a reused thread local buffer, so unlike
+    /// `with_level(level, &format!(..))` no allocation is made per message.
+    #[inline]
+    pub fn with_level_args(&self, level: Level, args: fmt::Arguments) {
+        if !level.is_statically_enabled() {
+            return;
+        }
+
+        with_formatted(args, |message| unsafe {
+            wrapped_os_log_with_type(self.inner, level as u8, message.as_ptr())
+        })
+    }
+
+    /// Like `with_level`, but records where the message was logged from as
+    /// separate arguments, rather than as part of the message.
+    #[inline]
+    pub fn with_level_at(&self, level: Level, location: &Location, message: &str) {
+        if !level.is_statically_enabled() {
+            return;
+        }
+
+        if message.as_bytes().contains(&0) {
+            return self.log_at(level, location, &message.replace('\0', "(null)"));
+        }
+
+        self.log_at(level, location, message)
+    }
+
+    /// Like `with_level_args`, but records where the message was logged from
+    /// as separate arguments, rather than as part of the message.
+    #[inline]
+    pub fn with_level_args_at(&self, level: Level, location: &Location, args: fmt::Arguments) {
+        if !level.is_statically_enabled() {
+            return;
+        }
+
+        with_formatted(args, |message| {
+            // Safety: the message was checked for nul bytes, or had them
+            // replaced, while it was converted.
+            self.log_at(level, location, unsafe {
+                std::str::from_utf8_unchecked(message.to_bytes())
+            })
+        })
+    }
+
+    /// Logs a message which doesn't contain nul bytes, along with its location.
+    fn log_at(&self, level: Level, location: &Location, message: &str) {
+        let len = |s: &str| s.len().min(c_int::MAX as usize) as c_int;
+
+        unsafe {
+            wrapped_os_log_with_location(
+                self.inner,
+                level as u8,
+                location.file.as_ptr() as *const c_char,
+                len(location.file),
+                location.line,
+                location.module_path.as_ptr() as *const c_char,
+                len(location.module_path),
+                message.as_ptr() as *const c_char,
+                len(message),
+            )
+        }
+    }
+
+    /// Logs the messages with one call into the OS per batch of them, rather
+    /// than one per message. Unlike `with_level`, messages aren't copied to
+    /// terminate them unless they contain nul bytes.
+    pub fn with_level_batch(&self, messages: &[(Level, &str)]) {
+        self.with_level_batch_iter(messages.iter().copied())
+    }
+
+    /// Like `with_level_batch`, for messages from an iterator.
+    pub fn with_level_batch_iter<'a>(&self, messages: impl IntoIterator<Item = (Level, &'a str)>) {
+        let empty = wrapped_os_log_message {
+            log_type: 0,
+            length: 0,
+            message: ptr::null(),
+        };
+
+        let mut batch = [empty; BATCH_LEN];
+        let mut len = 0;
+
+        // Owns the copies of messages which contained nul bytes until the
+        // batch they're in has been logged.
+        let mut fixed = Vec::new();
+
+        for (level, message) in messages {
+            if !level.is_statically_enabled() {
+                continue;
+            }
+
+            let entry = |message: &str| wrapped_os_log_message {
+                log_type: level as u8,
+                length: message.len().min(c_int::MAX as usize) as c_int,
+                message: message.as_ptr() as *const c_char,
+            };
+
+            if message.as_bytes().contains(&0) {
+                let copy = message.replace('\0', "(null)");
+                batch[len] = entry(&copy);
+
+                // Moving the string doesn't move its contents.
+                fixed.push(copy);
+            } else {
+                batch[len] = entry(message);
+            }
+
+            len += 1;
+
+            if len == BATCH_LEN {
+                unsafe { wrapped_os_log_batch(self.inner, batch.as_ptr(), len) };
+                fixed.clear();
+                len = 0;
+            }
+        }
+
+        if len > 0 {
+            unsafe { wrapped_os_log_batch(self.inner, batch.as_ptr(), len) };
+        }
+    }
+
+    #[inline]
     pub fn debug(&self, message: &str) {
-        let message = to_cstr(message);
-        unsafe { wrapped_os_log_debug(self.inner, message.as_ptr()) }
+        self.with_level(Level::Debug, message)
     }
 
+    #[inline]
     pub fn info(&self, message: &str) {
-        let message = to_cstr(message);
-        unsafe { wrapped_os_log_info(self.inner, message.as_ptr()) }
+        self.with_level(Level::Info, message)
     }
 
+    #[inline]
     pub fn default(&self, message: &str) {
-        let message = to_cstr(message);
-        unsafe { wrapped_os_log_default(self.inner, message.as_ptr()) }
+        self.with_level(Level::Default, message)
     }
 
+    #[inline]
     pub fn error(&self, message: &str) {
-        let message = to_cstr(message);
-        unsafe { wrapped_os_log_error(self.inner, message.as_ptr()) }
+        self.with_level(Level::Error, message)
     }
 
+    #[inline]
     pub fn fault(&self, message: &str) {
-        let message = to_cstr(message);
-        unsafe { wrapped_os_log_fault(self.inner, message.as_ptr()) }
+        self.with_level(Level::Fault, message)
     }
 
+    #[inline]
     pub fn level_is_enabled(&self, level: Level) -> bool {
-        unsafe { os_log_type_enabled(self.inner, level as u8) }
+        level.is_statically_enabled() && unsafe { os_log_type_enabled(self.inner, level as u8) }
     }
 }
 
@@ -113,6 +534,166 @@ impl OsLog {
 mod tests {
     use super::*;
 
+    #[test]
+    fn test_with_cstr() {
+        with_cstr("Hi", |cstr| assert_eq!(cstr.to_bytes(), b"Hi"));
+        with_cstr("", |cstr| assert_eq!(cstr.to_bytes(), b""));
+        with_cstr("Hi\0test", |cstr| {
+            assert_eq!(cstr.to_bytes(), b"Hi(null)test")
+        });
+
+        let long = "a".repeat(STACK_BUFFER_LEN);
+        with_cstr(&long, |cstr| assert_eq!(cstr.to_bytes(), long.as_bytes()));
+
+        let short = "a".repeat(STACK_BUFFER_LEN - 1);
+        with_cstr(&short, |cstr| assert_eq!(cstr.to_bytes(), short.as_bytes()));
+    }
+
+    #[test]
+    fn test_cstr_writer() {
+        let mut buffer = Vec::new();
+        write!(CStrWriter(&mut buffer), "\0a{}\0{}", "\0b\0", 1).unwrap();
+        assert_eq!(buffer, b"(null)a(null)b(null)(null)1");
+    }
+
+    #[test]
+    fn test_with_level_args() {
+        let log = OsLog::new("com.example.oslog", "category");
+        let long = "a".repeat(MAX_RETAINED_BUFFER_LEN + 1);
+
+        log.with_level_args(Level::Default, format_args!("Static"));
+        log.with_level_args(Level::Default, format_args!("{}", "Hi\0test"));
+        log.with_level_args(Level::Default, format_args!("{}", long));
+        BUFFER.with(|buffer| assert_eq!(buffer.borrow().capacity(), 0));
+
+        let value = 1;
+        log.with_level_args(Level::Default, format_args!("{}", value));
+        BUFFER.with(|buffer| assert_eq!(&*buffer.borrow(), b"1\0"));
+    }
+
+    #[test]
+    fn test_with_level_args_reentrant() {
+        struct Nested<'a>(&'a OsLog);
+
+        impl fmt::Display for Nested<'_> {
+            fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+                self.0
+                    .with_level_args(Level::Default, format_args!("{}", "Inner"));
+                f.write_str("Outer")
+            }
+        }
+
+        let log = OsLog::new("com.example.oslog", "category");
+        log.with_level_args(Level::Default, format_args!("{}", Nested(&log)));
+    }
+
+    #[test]
+    fn test_with_level_batch() {
+        let log = OsLog::new("com.example.oslog", "category");
+        let long = "a".repeat(STACK_BUFFER_LEN);
+
+        log.with_level_batch(&[]);
+        log.with_level_batch(&[
+            (Level::Debug, "Debug"),
+            (Level::Error, "Hi\0test"),
+            (Level::Default, &long),
+            (Level::Info, ""),
+        ]);
+
+        let messages: Vec<String> = (0..BATCH_LEN * 2 + 1).map(|i| format!("{}\0", i)).collect();
+        log.with_level_batch_iter(messages.iter().map(|m| (Level::Default, m.as_str())));
+    }
+
+    #[test]
+    fn test_verbosity() {
+        let levels = [
+            Level::Fault,
+            Level::Error,
+            Level::Default,
+            Level::Info,
+            Level::Debug,
+        ];
+
+        assert!(levels
+            .windows(2)
+            .all(|pair| pair[0].verbosity() < pair[1].verbosity()));
+
+        // Disabling a level disables every more verbose one too.
+        assert!(levels
+            .windows(2)
+            .all(|pair| pair[0].is_statically_enabled() || !pair[1].is_statically_enabled()));
+
+        #[cfg(feature = "logger")]
+        for level in [log::Level::Error, log::Level::Info, log::Level::Trace] {
+            assert_eq!(
+                Level::from(level).is_statically_enabled(),
+                level <= static_level_filter()
+            );
+        }
+    }
+
+    #[test]
+    fn test_no_allocations() {
+        use crate::counting::allocations;
+
+        let log = OsLog::new("com.example.oslog", "category");
+        let value = 1;
+
+        // The first formatted message allocates the thread's buffer.
+        log.with_level_args(Level::Default, format_args!("Formatted {}", value));
+
+        let count = allocations(|| {
+            log.level_is_enabled(Level::Debug);
+            log.with_level(Level::Default, "Short");
+            log.default("Short");
+            log.with_level_args(Level::Default, format_args!("Formatted {}", value));
+            log.with_level_batch(&[(Level::Default, "First"), (Level::Error, "Second")]);
+            log.with_level_cstr(Level::Default, os_log_cstr!("Static"));
+        });
+
+        assert_eq!(count, 0);
+
+        // Long messages are copied once, with room for the nul.
+        let long = "a".repeat(1000);
+        assert_eq!(allocations(|| log.with_level(Level::Default, &long)), 1);
+    }
+
+    #[test]
+    fn test_with_level_at() {
+        let log = OsLog::new("com.example.oslog", "category");
+        let location = Location {
+            file: file!(),
+            line: line!(),
+            module_path: module_path!(),
+        };
+
+        let value = 1;
+        log.with_level_at(Level::Default, &location, "Static");
+        log.with_level_at(Level::Default, &location, "Hi\0test");
+        log.with_level_args_at(Level::Default, &location, format_args!("{}", value));
+        log.with_level_args_at(Level::Default, &location, format_args!("Static"));
+    }
+
+    #[test]
+    fn test_with_level_cstr() {
+        let log = OsLog::new("com.example.oslog", "category");
+        let message = os_log_cstr!("Static");
+        assert_eq!(message.to_bytes(), b"Static");
+
+        log.with_level_cstr(Level::Default, message);
+        log.with_level_cstr(Level::Info, &CString::new("Owned").unwrap());
+    }
+
+    #[test]
+    fn test_static_category() {
+        let logs: Vec<&OsLog> = (0..2)
+            .map(|_| oslog_category!("com.example.oslog", "static"))
+            .collect();
+
+        assert!(std::ptr::eq(logs[0], logs[1]));
+        logs[0].debug("Debug");
+    }
+
     #[test]
     fn test_subsystem_interior_null() {
         let log = OsLog::new("com.example.oslog\0test", "category");
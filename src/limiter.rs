@@ -0,0 +1,299 @@
+use log::Record;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::OnceLock;
+use std::time::Instant;
+
+/// How many buckets a per call site limit hashes call sites into. Call sites
+/// which land in the same bucket share its budget.
+const CALL_SITE_BUCKETS: usize = 64;
+
+/// Limits how often records are logged for a category, as a steady rate with
+/// room for short bursts above it.
+///
+/// ```
+/// use oslog::RateLimit;
+///
+/// // 10 records a second on average, but up to 50 at once.
+/// let limit = RateLimit::per_second(10).burst(50);
+/// ```
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct RateLimit {
+    per_second: u32,
+    burst: u32,
+    per_call_site: bool,
+}
+
+impl RateLimit {
+    /// Allows `per_second` records a second, with a burst of one.
+    pub fn per_second(per_second: u32) -> Self {
+        assert!(
+            per_second > 0,
+            "A rate limit must allow at least one record a second"
+        );
+
+        Self {
+            per_second,
+            burst: 1,
+            per_call_site: false,
+        }
+    }
+
+    /// Allows up to `burst` records at once, as long as the rate has been
+    /// respected for long enough beforehand.
+    pub fn burst(self, burst: u32) -> Self {
+        Self {
+            burst: burst.max(1),
+            ..self
+        }
+    }
+
+    /// Applies the limit to each call site in the category separately,
+    /// rather than to the category as a whole, so one noisy call site doesn't
+    /// silence the others.
+    pub fn per_call_site(self) -> Self {
+        Self {
+            per_call_site: true,
+            ..self
+        }
+    }
+}
+
+struct Bucket {
+    /// When the bucket will next be empty, using the generic cell rate
+    /// algorithm, in nanoseconds since `epoch`.
+    empty_at: AtomicU64,
+    suppressed: AtomicU64,
+}
+
+/// What to do with a record.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) enum Decision {
+    /// Log it, after a summary of how many records were suppressed since the
+    /// last one if that isn't zero.
+    Allow {
+        suppressed: u64,
+    },
+    Suppress,
+}
+
+/// Tracks a rate limit for one category.
+pub(crate) struct Limiter {
+    limit: RateLimit,
+    /// The time between records at the steady rate.
+    interval: u64,
+    /// How far `empty_at` can be ahead of the current time.
+    tolerance: u64,
+    buckets: Box<[Bucket]>,
+}
+
+fn epoch() -> Instant {
+    static EPOCH: OnceLock<Instant> = OnceLock::new();
+    *EPOCH.get_or_init(Instant::now)
+}
+
+fn now() -> u64 {
+    epoch().elapsed().as_nanos() as u64
+}
+
+impl Limiter {
+    pub fn new(limit: RateLimit) -> Self {
+        let interval = 1_000_000_000 / limit.per_second as u64;
+        let len = if limit.per_call_site {
+            CALL_SITE_BUCKETS
+        } else {
+            1
+        };
+
+        // Started before any record is checked, so `now` never underflows.
+        epoch();
+
+        Self {
+            limit,
+            interval,
+            tolerance: interval * (limit.burst as u64 - 1),
+            buckets: (0..len)
+                .map(|_| Bucket {
+                    empty_at: AtomicU64::new(0),
+                    suppressed: AtomicU64::new(0),
+                })
+                .collect(),
+        }
+    }
+
+    pub fn limit(&self) -> RateLimit {
+        self.limit
+    }
+
+    /// Decides whether to log the record. This doesn't look at its contents,
+    /// so it's meant to be called before the record is formatted.
+    #[inline]
+    pub fn check(&self, record: &Record) -> Decision {
+        self.check_at(self.bucket(record), now())
+    }
+
+    fn bucket(&self, record: &Record) -> &Bucket {
+        if self.buckets.len() == 1 {
+            return &self.buckets[0];
+        }
+
+        // File names usually come from `file!()`, so the pointer identifies
+        // the file without hashing its contents.
+        let file = record.file().map_or(0, |file| file.as_ptr() as u64);
+        let line = record.line().unwrap_or(0) as u64;
+        let hash = (file ^ line.rotate_left(32)).wrapping_mul(0x9E37_79B9_7F4A_7C15);
+
+        &self.buckets[(hash >> 32) as usize % self.buckets.len()]
+    }
+
+    /// Takes the number of records suppressed in bursts which are over, whose
+    /// summary would otherwise wait for the category's next record. Bursts
+    /// which are still going on are left to the record which ends them,
+    /// unless `all` is set.
+    pub fn take_suppressed(&self, all: bool) -> u64 {
+        self.take_suppressed_at(now(), all)
+    }
+
+    fn take_suppressed_at(&self, now: u64, all: bool) -> u64 {
+        self.buckets
+            .iter()
+            .filter(|bucket| {
+                all || bucket.empty_at.load(Ordering::Relaxed).saturating_sub(now) <= self.tolerance
+            })
+            .map(|bucket| match bucket.suppressed.load(Ordering::Relaxed) {
+                0 => 0,
+                _ => bucket.suppressed.swap(0, Ordering::Relaxed),
+            })
+            .sum()
+    }
+
+    #[cfg(test)]
+    pub fn suppressed(&self) -> u64 {
+        self.buckets
+            .iter()
+            .map(|bucket| bucket.suppressed.load(Ordering::Relaxed))
+            .sum()
+    }
+
+    fn check_at(&self, bucket: &Bucket, now: u64) -> Decision {
+        let mut empty_at = bucket.empty_at.load(Ordering::Relaxed);
+
+        loop {
+            let start = empty_at.max(now);
+
+            if start - now > self.tolerance {
+                bucket.suppressed.fetch_add(1, Ordering::Relaxed);
+                return Decision::Suppress;
+            }
+
+            match bucket.empty_at.compare_exchange_weak(
+                empty_at,
+                start + self.interval,
+                Ordering::Relaxed,
+                Ordering::Relaxed,
+            ) {
+                Ok(_) => break,
+                Err(current) => empty_at = current,
+            }
+        }
+
+        // Only touch the counter's cache line again if something was dropped.
+        let suppressed = match bucket.suppressed.load(Ordering::Relaxed) {
+            0 => 0,
+            _ => bucket.suppressed.swap(0, Ordering::Relaxed),
+        };
+
+        Decision::Allow { suppressed }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const SECOND: u64 = 1_000_000_000;
+
+    #[test]
+    fn test_steady_rate() {
+        let limiter = Limiter::new(RateLimit::per_second(10));
+        let bucket = &limiter.buckets[0];
+
+        assert_eq!(
+            limiter.check_at(bucket, SECOND),
+            Decision::Allow { suppressed: 0 }
+        );
+        assert_eq!(limiter.check_at(bucket, SECOND + 1), Decision::Suppress);
+        assert_eq!(limiter.check_at(bucket, SECOND + 2), Decision::Suppress);
+        assert_eq!(
+            limiter.check_at(bucket, SECOND + SECOND / 10),
+            Decision::Allow { suppressed: 2 }
+        );
+        assert_eq!(
+            limiter.check_at(bucket, 2 * SECOND),
+            Decision::Allow { suppressed: 0 }
+        );
+    }
+
+    #[test]
+    fn test_burst() {
+        let limiter = Limiter::new(RateLimit::per_second(1).burst(3));
+        let bucket = &limiter.buckets[0];
+
+        for _ in 0..3 {
+            assert_eq!(
+                limiter.check_at(bucket, SECOND),
+                Decision::Allow { suppressed: 0 }
+            );
+        }
+
+        assert_eq!(limiter.check_at(bucket, SECOND), Decision::Suppress);
+
+        // Waiting refills the bucket at the steady rate.
+        assert_eq!(
+            limiter.check_at(bucket, 2 * SECOND),
+            Decision::Allow { suppressed: 1 }
+        );
+        assert_eq!(limiter.check_at(bucket, 2 * SECOND), Decision::Suppress);
+    }
+
+    #[test]
+    fn test_take_suppressed() {
+        let limiter = Limiter::new(RateLimit::per_second(10));
+        let bucket = &limiter.buckets[0];
+
+        limiter.check_at(bucket, SECOND);
+        limiter.check_at(bucket, SECOND);
+        limiter.check_at(bucket, SECOND);
+
+        // The burst is still going on, so the next record reports it.
+        assert_eq!(limiter.take_suppressed_at(SECOND, false), 0);
+        assert_eq!(limiter.take_suppressed_at(2 * SECOND, false), 2);
+        assert_eq!(limiter.take_suppressed_at(2 * SECOND, false), 0);
+        assert_eq!(
+            limiter.check_at(bucket, 2 * SECOND),
+            Decision::Allow { suppressed: 0 }
+        );
+
+        limiter.check_at(bucket, 2 * SECOND);
+        assert_eq!(limiter.take_suppressed_at(2 * SECOND, true), 1);
+    }
+
+    #[test]
+    fn test_call_sites() {
+        let limiter = Limiter::new(RateLimit::per_second(1).per_call_site());
+        let first = Record::builder().line(Some(0)).build();
+
+        // Find a call site which doesn't share the first one's bucket.
+        let line = (1..)
+            .find(|&line| {
+                let other = Record::builder().line(Some(line)).build();
+                !std::ptr::eq(limiter.bucket(&first), limiter.bucket(&other))
+            })
+            .unwrap();
+
+        let second = Record::builder().line(Some(line)).build();
+
+        assert!(matches!(limiter.check(&first), Decision::Allow { .. }));
+        assert_eq!(limiter.check(&first), Decision::Suppress);
+        assert!(matches!(limiter.check(&second), Decision::Allow { .. }));
+    }
+}
@@ -1,67 +1,484 @@
-use crate::OsLog;
-use dashmap::DashMap;
+use crate::arena::Text;
+use crate::emitter::{Emitter, Message, Overflow};
+use crate::fork;
+use crate::kv;
+use crate::limiter::{Decision, RateLimit};
+use crate::registry::{Category, Registry};
+use crate::routes::Routes;
+use crate::sampler::Sampling;
+use crate::stats::{CategoryStats, Measured};
+use crate::{static_level_filter, Level, Location};
+use log::kv::Source;
 use log::{LevelFilter, Log, Metadata, Record};
+use std::fmt;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
+
+/// The key-values of messages which aren't from a record.
+const NO_PAIRS: [(&str, i64); 0] = [];
 
 pub struct OsLogger {
-    loggers: DashMap<String, (Option<LevelFilter>, OsLog)>,
-    subsystem: String,
+    registry: Arc<Registry>,
+    routes: Arc<Routes>,
+    emitter: Option<Emitter>,
+    overflow: Overflow,
+    location: bool,
+    /// The registry's epoch when rate limited categories last had their
+    /// suppressed records summarized.
+    summarized: AtomicU64,
 }
 
 impl Log for OsLogger {
     fn enabled(&self, metadata: &Metadata) -> bool {
-        let max_level = self
-            .loggers
-            .get(metadata.target())
-            .and_then(|pair| (*pair).0)
-            .unwrap_or_else(|| log::max_level());
+        if metadata.level() > static_level_filter() {
+            return false;
+        }
+
+        let epoch = self.registry.epoch();
 
-        metadata.level() <= max_level
+        self.registry
+            .with(metadata.target(), |category| match category {
+                Some(category) => category.is_enabled(metadata.level(), epoch, &self.registry),
+                None => metadata.level() <= self.registry.level(),
+            })
     }
 
     fn log(&self, record: &Record) {
-        if self.enabled(record.metadata()) {
-            let pair = self
-                .loggers
-                .entry(record.target().into())
-                .or_insert((None, OsLog::new(&self.subsystem, record.target())));
+        if record.level() > static_level_filter() {
+            return;
+        }
+
+        // Resolve the category once and use the same entry for both the level
+        // check and the output, rather than looking the target up again after
+        // `enabled`. Most records go to a category which this thread has
+        // already cached, in which case no lock is taken, and whose enabled
+        // levels are already worked out.
+        let epoch = self.registry.epoch();
+
+        if epoch != self.summarized.load(Ordering::Relaxed) {
+            self.summarize(epoch, false);
+        }
+
+        self.registry.with(record.target(), |category| {
+            let created;
+            let category = match category {
+                Some(category) => category,
+                None if record.level() <= self.registry.level() => {
+                    created = self
+                        .registry
+                        .get_or_insert(record.target(), |name| self.routes.log(name));
+                    &created
+                }
+                None => return,
+            };
+
+            if category.is_enabled(record.level(), epoch, &self.registry) {
+                self.emit(category, record);
+            } else if let Some(stats) = &category.stats {
+                stats.filtered();
+            }
+        });
+    }
+
+    /// Summarizes every category's suppressed records, and waits for the
+    /// background thread to output every record logged so far, when logging
+    /// asynchronously.
+    fn flush(&self) {
+        self.summarize(self.registry.current_epoch(), true);
 
-            let message = std::format!("{}", record.args());
-            (*pair).1.with_level(record.level().into(), &message);
+        if let Some(emitter) = &self.emitter {
+            emitter.flush();
         }
     }
+}
 
-    fn flush(&self) {}
+/// The record's location, if it's known at compile time.
+fn location(record: &Record) -> Option<Location<'static>> {
+    Some(Location {
+        file: record.file_static()?,
+        line: record.line()?,
+        module_path: record.module_path_static().unwrap_or(""),
+    })
 }
 
 impl OsLogger {
+    /// Formats and outputs the record, or queues it for the background thread,
+    /// unless it's sampled out or over the category's rate limit, in which
+    /// case the formatting is skipped entirely. The record's level must be
+    /// enabled for the category.
+    #[inline]
+    fn emit(&self, category: &Arc<Category>, record: &Record) {
+        let level = record.level().into();
+
+        // Sampled out records don't use up any of the rate limit.
+        if let Some(sampler) = &category.sampler {
+            if !sampler.keep(record.level()) {
+                if let Some(stats) = &category.stats {
+                    stats.sampled_out();
+                }
+
+                return;
+            }
+        }
+
+        if let Some(limiter) = &category.limiter {
+            match limiter.check(record) {
+                Decision::Suppress => {
+                    if let Some(stats) = &category.stats {
+                        stats.rate_limited();
+                    }
+
+                    return;
+                }
+                Decision::Allow { suppressed: 0 } => {}
+                Decision::Allow { suppressed } => self.emit_suppressed(category, level, suppressed),
+            }
+        }
+
+        let location = if self.location {
+            location(record)
+        } else {
+            None
+        };
+
+        let source = Some(record.key_values());
+
+        let sent = match (record.args().as_str(), &category.stats) {
+            (Some(_), _) | (_, None) => {
+                self.emit_args(category, level, location, *record.args(), source)
+            }
+            (None, Some(stats)) => {
+                let measured = Measured {
+                    args: *record.args(),
+                    stats,
+                };
+
+                self.emit_args(
+                    category,
+                    level,
+                    location,
+                    format_args!("{}", measured),
+                    source,
+                )
+            }
+        };
+
+        match (&category.stats, sent) {
+            (Some(stats), true) => stats.emitted(),
+            (Some(stats), false) => stats.dropped(),
+            (None, _) => {}
+        }
+    }
+
+    fn emit_suppressed(&self, category: &Arc<Category>, level: Level, suppressed: u64) {
+        self.emit_args(
+            category,
+            level,
+            None,
+            format_args!("{} messages suppressed", suppressed),
+            None,
+        );
+    }
+
+    /// Logs the summaries of records suppressed by categories which have gone
+    /// quiet since, which would otherwise wait for their next record. This
+    /// happens once an epoch, so about every refresh interval while anything
+    /// is being logged, and for every category's suppressed records, quiet
+    /// or not, if `all` is set.
+    #[cold]
+    fn summarize(&self, epoch: u64, all: bool) {
+        if self.summarized.swap(epoch, Ordering::Relaxed) == epoch && !all {
+            return;
+        }
+
+        self.registry
+            .for_each_limited(|category, limiter| match limiter.take_suppressed(all) {
+                0 => {}
+                suppressed => self.emit_suppressed(category, Level::Default, suppressed),
+            });
+    }
+
+    fn emit_args(
+        &self,
+        category: &Arc<Category>,
+        level: Level,
+        location: Option<Location<'static>>,
+        args: fmt::Arguments,
+        source: Option<&dyn Source>,
+    ) -> bool {
+        let source = source.unwrap_or(&NO_PAIRS);
+
+        // Key-values only outlive the record when they're logged right away,
+        // and there's no format combining them with a location, so otherwise
+        // they're formatted into the message.
+        match (&self.emitter, &location) {
+            (Some(emitter), _) => kv::with_pairs(args, source, |args| {
+                emitter.send(Message {
+                    category: category.clone(),
+                    level,
+                    location,
+                    text: Text::format(args),
+                })
+            }),
+            (None, Some(location)) => {
+                kv::with_pairs(args, source, |args| {
+                    category.log.with_level_args_at(level, location, args)
+                });
+                true
+            }
+            (None, None) if source.count() == 0 => {
+                category.log.with_level_args(level, args);
+                true
+            }
+            (None, None) => {
+                if !kv::log_with_pairs(&category.log, level, args, source) {
+                    kv::with_pairs(args, source, |args| {
+                        category.log.with_level_args(level, args)
+                    })
+                }
+
+                true
+            }
+        }
+    }
+
     /// Creates a new logger. You must also call `init` to finalize the set up.
     /// By default the level filter will be set to `LevelFilter::Trace`.
     pub fn new(subsystem: &str) -> Self {
+        let registry = Arc::new(Registry::new());
+        fork::register(&registry);
+
         Self {
-            loggers: DashMap::new(),
-            subsystem: subsystem.to_string(),
+            registry,
+            routes: Arc::new(Routes::new(subsystem)),
+            emitter: None,
+            overflow: Overflow::Drop,
+            location: false,
+            summarized: AtomicU64::new(0),
         }
     }
 
-    /// Only levels at or above `level` will be logged.
+    /// Creates the categories of targets starting with `prefix` in
+    /// `subsystem` rather than the logger's own, so one process can log to
+    /// several subsystems. Prefixes are matched as plain strings, the longest
+    /// which matches wins, and each target is only routed once, when its
+    /// category is created. Routes should be added before setting up any
+    /// categories they cover.
+    ///
+    /// ```
+    /// use oslog::OsLogger;
+    ///
+    /// let logger = OsLogger::new("com.example.app")
+    ///     .subsystem_for("app::net", "com.example.net")
+    ///     .subsystem_for("hyper", "com.example.net");
+    /// ```
+    pub fn subsystem_for(mut self, prefix: &str, subsystem: &str) -> Self {
+        Arc::make_mut(&mut self.routes).insert(prefix, subsystem);
+        self
+    }
+
+    /// Only levels at or above `level` will be logged. Levels which have been
+    /// compiled out with the `max_level_*` features stay disabled. It's only
+    /// made `log`'s max level once the logger is installed.
     pub fn level_filter(self, level: LevelFilter) -> Self {
-        log::set_max_level(level);
+        self.registry.set_level_filter(level);
         self
     }
 
-    /// Sets or updates the category's level filter.
+    /// Sets or updates the category's level filter. It can be changed again
+    /// after `init` through the returned handle.
     pub fn category_level_filter(self, category: &str, level: LevelFilter) -> Self {
-        self.loggers
-            .entry(category.into())
-            .and_modify(|(existing_level, _)| *existing_level = Some(level))
-            .or_insert((Some(level), OsLog::new(&self.subsystem, category)));
+        self.registry
+            .set_level(category, Some(level), || self.routes.log(category));
+
+        self
+    }
+
+    /// Limits how often the category's records are logged. Records over the
+    /// limit are dropped before they're formatted, and the next record which
+    /// is logged is preceded by a count of them. If the category goes quiet
+    /// instead, the count is logged by itself within about a refresh
+    /// interval, as long as other records are being logged, or on `flush`.
+    pub fn category_rate_limit(self, category: &str, limit: RateLimit) -> Self {
+        self.registry
+            .set_limit(category, limit, || self.routes.log(category));
+
+        self
+    }
+
+    /// Keeps a sample of the category's records at `level` and more verbose
+    /// ones, decided before they're formatted, while logging all of the less
+    /// verbose ones. This lets verbose levels stay enabled on busy categories
+    /// to get a statistical picture of them.
+    ///
+    /// ```
+    /// use log::LevelFilter;
+    /// use oslog::{OsLogger, Sampling};
+    ///
+    /// let logger = OsLogger::new("com.example.test")
+    ///     .category_sampling("Network", LevelFilter::Debug, Sampling::one_in(100));
+    /// ```
+    pub fn category_sampling(self, category: &str, level: LevelFilter, sampling: Sampling) -> Self {
+        self.registry
+            .set_sampling(category, level, sampling, || self.routes.log(category));
+
+        self
+    }
+
+    /// How often to ask the OS again which levels it's collecting for each
+    /// category, which is cached so records at disabled levels cost as little
+    /// as possible. Defaults to a second.
+    pub fn os_refresh_interval(self, interval: Duration) -> Self {
+        self.registry.set_refresh_interval(interval);
+        self
+    }
+
+    /// Keeps counters for each category, which the handle's `stats` returns.
+    /// They're off by default, since each category's take up to a couple of
+    /// kilobytes and cost a few atomic adds per record.
+    pub fn collect_stats(self, enabled: bool) -> Self {
+        self.registry
+            .set_stats(enabled, |category| self.routes.log(category));
+        self
+    }
+
+    /// Keeps at most `max` categories, for programs with targets which are
+    /// built at run time, so memory use stays flat. Once there are that many,
+    /// the least recently used category is evicted and its log released to
+    /// make room for a new one. Categories with their own level filter or
+    /// rate limit are never evicted, and if they're all that's left, records
+    /// for new targets go to the "overflow" category instead.
+    pub fn max_categories(self, max: usize) -> Self {
+        self.registry.set_capacity(max);
+        self
+    }
+
+    /// Records the file, line and module each record was logged from, as
+    /// separate arguments rather than as part of the message. Only locations
+    /// which are known at compile time are recorded, as they are for the
+    /// `log` macros.
+    pub fn source_location(mut self, enabled: bool) -> Self {
+        self.location = enabled;
+        self
+    }
+
+    /// Formats records on the thread which logs them, but leaves the rest to a
+    /// background thread, queueing up to `capacity` records for it. By default
+    /// records are dropped if the queue is full, see `overflow`.
+    ///
+    /// Records are formatted into memory owned by the logging thread, which is
+    /// reused once the background thread is done with them, rather than being
+    /// allocated one by one.
+    ///
+    /// Records which are still queued when the process exits are lost, unless
+    /// `log::logger().flush()` is called first.
+    pub fn asynchronous(mut self, capacity: usize) -> Self {
+        let mut emitter = Emitter::new(capacity);
+        emitter.set_overflow(self.overflow);
+        self.emitter = Some(emitter);
+        self
+    }
+
+    /// Sets what happens to records when the asynchronous queue is full.
+    /// Has no effect unless `asynchronous` is also used.
+    pub fn overflow(mut self, overflow: Overflow) -> Self {
+        self.overflow = overflow;
+
+        if let Some(emitter) = &mut self.emitter {
+            emitter.set_overflow(overflow);
+        }
 
         self
     }
 
-    pub fn init(self) -> Result<(), log::SetLoggerError> {
-        log::set_boxed_logger(Box::new(self))
+    /// Installs the logger, returning a handle which can change its filters
+    /// while it's in use.
+    ///
+    /// The logger keeps working in child processes, so it can be installed
+    /// once before forking workers. The children log straight away without
+    /// installing it again, and anything queued for the background thread at
+    /// the time of the fork is only output by the parent.
+    pub fn init(self) -> Result<OsLoggerHandle, log::SetLoggerError> {
+        let handle = self.handle();
+        let registry = self.registry.clone();
+        log::set_boxed_logger(Box::new(self))?;
+        registry.install();
+        Ok(handle)
     }
+
+    fn handle(&self) -> OsLoggerHandle {
+        OsLoggerHandle::new(self.registry.clone(), self.routes.clone())
+    }
+}
+
+/// Changes an installed logger's filters. Each change is a single atomic
+/// store, which records being logged on other threads see straight away.
+#[derive(Clone)]
+pub struct OsLoggerHandle {
+    registry: Arc<Registry>,
+    routes: Arc<Routes>,
+}
+
+impl OsLoggerHandle {
+    pub(crate) fn new(registry: Arc<Registry>, routes: Arc<Routes>) -> Self {
+        Self { registry, routes }
+    }
+
+    /// Sets or updates the level filter used by categories without their own.
+    /// For an installed logger it's `log`'s max level too, while a handle to a
+    /// standalone layer only changes the layer.
+    pub fn set_level_filter(&self, level: LevelFilter) {
+        self.registry.set_level_filter(level);
+        rebuild_interest();
+    }
+
+    /// Asks the OS again which levels it's collecting for each category, for
+    /// after the system's logging configuration has changed. This also
+    /// happens by itself every refresh interval.
+    pub fn refresh(&self) {
+        self.registry.refresh();
+        rebuild_interest();
+    }
+
+    /// Sets or updates the category's level filter.
+    pub fn set_category_level_filter(&self, category: &str, level: LevelFilter) {
+        self.registry
+            .set_level(category, Some(level), || self.routes.log(category));
+
+        rebuild_interest();
+    }
+
+    /// Removes the category's level filter, so it uses the global one again.
+    pub fn clear_category_level_filter(&self, category: &str) {
+        self.registry
+            .set_level(category, None, || self.routes.log(category));
+
+        rebuild_interest();
+    }
+
+    /// Snapshots the counters kept for each category, if the logger was built
+    /// with `collect_stats`: how many records were logged, filtered out, rate
+    /// limited and dropped from a full queue, and how much formatting them
+    /// cost. The counters of evicted categories are discarded with them.
+    pub fn stats(&self) -> Vec<CategoryStats> {
+        self.registry.stats()
+    }
+
+    /// Creates a `tracing` layer which shares the logger's categories and
+    /// their filters.
+    #[cfg(feature = "tracing")]
+    pub fn layer(&self) -> crate::OsLogLayer {
+        crate::OsLogLayer::with_registry(self.registry.clone(), self.routes.clone())
+    }
+}
+
+/// Tells `tracing` to ask layers which callsites they're interested in again,
+/// since a filter they depend on has changed.
+#[inline]
+fn rebuild_interest() {
+    #[cfg(feature = "tracing")]
+    tracing_core::callsite::rebuild_interest_cache();
 }
 
 #[cfg(test)]
@@ -91,4 +508,342 @@ mod tests {
         warn!(target: "Database", "Warn");
         error!("Error");
     }
+
+    #[test]
+    fn test_category_created_once() {
+        let logger = OsLogger::new("com.example.oslog").level_filter(LevelFilter::Trace);
+
+        for _ in 0..3 {
+            logger.log(
+                &Record::builder()
+                    .level(log::Level::Error)
+                    .target("Created")
+                    .args(format_args!("Error"))
+                    .build(),
+            );
+        }
+
+        assert_eq!(logger.registry.len(), 1);
+        assert!(logger
+            .registry
+            .with("Created", |category| category.is_some()));
+    }
+
+    #[test]
+    fn test_subsystem_for() {
+        let logger = OsLogger::new("com.example.oslog")
+            .subsystem_for("Routed", "com.example.routed")
+            .level_filter(LevelFilter::Trace);
+
+        logger.log(
+            &Record::builder()
+                .level(log::Level::Error)
+                .target("Routed::Inner")
+                .args(format_args!("Error"))
+                .build(),
+        );
+
+        assert_eq!(
+            logger.routes.subsystem("Routed::Inner"),
+            "com.example.routed"
+        );
+        assert_eq!(logger.routes.subsystem("Other"), "com.example.oslog");
+        assert!(logger
+            .registry
+            .with("Routed::Inner", |category| category.is_some()));
+        assert!(Arc::ptr_eq(&logger.routes, &logger.handle().routes));
+    }
+
+    #[test]
+    fn test_no_allocations() {
+        use crate::counting::allocations;
+
+        let logger = OsLogger::new("com.example.oslog")
+            .level_filter(LevelFilter::Trace)
+            .category_level_filter("Filtered", LevelFilter::Warn);
+
+        let value = 1;
+        let record = |level, target| {
+            logger.log(
+                &Record::builder()
+                    .level(level)
+                    .target(target)
+                    .args(format_args!("Record {}", value))
+                    .build(),
+            )
+        };
+
+        // Registers the category and caches it for this thread, and allocates
+        // the thread's formatting buffer.
+        record(log::Level::Error, "Registered");
+        record(log::Level::Error, "Filtered");
+
+        let count = allocations(|| {
+            record(log::Level::Error, "Registered");
+            record(log::Level::Info, "Filtered");
+            logger.enabled(&Metadata::builder().target("Registered").build());
+            logger.enabled(&Metadata::builder().target("Filtered").build());
+        });
+
+        assert_eq!(count, 0);
+    }
+
+    #[test]
+    fn test_source_location() {
+        for asynchronous in [false, true] {
+            let mut logger = OsLogger::new("com.example.oslog")
+                .level_filter(LevelFilter::Trace)
+                .source_location(true);
+
+            if asynchronous {
+                logger = logger.asynchronous(16);
+            }
+
+            let record = Record::builder()
+                .level(log::Level::Error)
+                .target("Location")
+                .file_static(Some(file!()))
+                .line(Some(line!()))
+                .module_path_static(Some(module_path!()))
+                .args(format_args!("Error"))
+                .build();
+
+            assert_eq!(
+                location(&record),
+                Some(Location {
+                    file: file!(),
+                    line: record.line().unwrap(),
+                    module_path: module_path!(),
+                })
+            );
+
+            logger.log(&record);
+            logger.flush();
+        }
+
+        assert_eq!(location(&Record::builder().build()), None);
+    }
+
+    #[test]
+    fn test_key_values() {
+        use crate::counting::allocations;
+
+        let pairs = [("count", log::kv::Value::from(1)), ("name", "test".into())];
+        let floats = [("elapsed", 0.5)];
+
+        for asynchronous in [false, true] {
+            let mut logger = OsLogger::new("com.example.oslog").level_filter(LevelFilter::Trace);
+
+            if asynchronous {
+                logger = logger.asynchronous(16);
+            }
+
+            let record = |source: &dyn log::kv::Source| {
+                logger.log(
+                    &Record::builder()
+                        .level(log::Level::Error)
+                        .target("KeyValues")
+                        .args(format_args!("Record"))
+                        .key_values(source)
+                        .build(),
+                )
+            };
+
+            record(&pairs);
+            record(&floats);
+            logger.flush();
+
+            // Pairs which are passed natively aren't formatted at all.
+            if !asynchronous {
+                assert_eq!(allocations(|| record(&pairs)), 0);
+            }
+        }
+    }
+
+    #[test]
+    fn test_handle() {
+        let logger = OsLogger::new("com.example.oslog").level_filter(LevelFilter::Trace);
+        let handle = logger.handle();
+        let metadata = |level| Metadata::builder().level(level).target("Handle").build();
+
+        assert!(logger.enabled(&metadata(log::Level::Debug)));
+
+        handle.set_category_level_filter("Handle", LevelFilter::Warn);
+        assert!(!logger.enabled(&metadata(log::Level::Debug)));
+        assert!(logger.enabled(&metadata(log::Level::Warn)));
+
+        handle.set_category_level_filter("Handle", LevelFilter::Trace);
+        assert!(logger.enabled(&metadata(log::Level::Debug)));
+
+        handle.clear_category_level_filter("Handle");
+        assert!(logger
+            .registry
+            .with("Handle", |category| category.unwrap().level().is_none()));
+    }
+
+    #[test]
+    fn test_stats() {
+        let logger = OsLogger::new("com.example.oslog")
+            .collect_stats(true)
+            .level_filter(LevelFilter::Trace)
+            .category_level_filter("Stats", LevelFilter::Info)
+            .category_rate_limit("Limited", RateLimit::per_second(1));
+
+        let value = 1;
+        let record = |level, target| {
+            logger.log(
+                &Record::builder()
+                    .level(level)
+                    .target(target)
+                    .args(format_args!("Value {}", value))
+                    .build(),
+            )
+        };
+
+        record(log::Level::Info, "Stats");
+        record(log::Level::Info, "Stats");
+        record(log::Level::Debug, "Stats");
+        record(log::Level::Error, "Limited");
+        record(log::Level::Error, "Limited");
+
+        let mut stats = logger.handle().stats();
+        stats.sort_by(|a, b| a.category.cmp(&b.category));
+
+        assert_eq!(stats.len(), 2);
+        assert_eq!(stats[0].category, "Limited");
+        assert_eq!((stats[0].emitted, stats[0].rate_limited), (1, 1));
+        assert_eq!(stats[1].category, "Stats");
+        assert_eq!((stats[1].emitted, stats[1].filtered), (2, 1));
+        assert_eq!(stats[1].formatted_bytes, 2 * "Value 1".len() as u64);
+    }
+
+    #[test]
+    fn test_stats_opt_in() {
+        let record = |logger: &OsLogger| {
+            logger.log(
+                &Record::builder()
+                    .level(log::Level::Error)
+                    .target("Configured")
+                    .args(format_args!("Error"))
+                    .build(),
+            )
+        };
+
+        let logger = OsLogger::new("com.example.oslog")
+            .category_level_filter("Configured", LevelFilter::Info);
+        record(&logger);
+        assert!(logger.handle().stats().is_empty());
+
+        // Categories which already exist start keeping them too.
+        let logger = OsLogger::new("com.example.oslog")
+            .category_level_filter("Configured", LevelFilter::Info)
+            .collect_stats(true);
+        record(&logger);
+        assert_eq!(logger.handle().stats()[0].emitted, 1);
+    }
+
+    #[test]
+    fn test_sampling() {
+        let logger = OsLogger::new("com.example.oslog")
+            .collect_stats(true)
+            .level_filter(LevelFilter::Trace)
+            .category_sampling("Sampled", LevelFilter::Debug, Sampling::fraction(0.0));
+
+        let record = |level| {
+            logger.log(
+                &Record::builder()
+                    .level(level)
+                    .target("Sampled")
+                    .args(format_args!("Record"))
+                    .build(),
+            )
+        };
+
+        record(log::Level::Info);
+        record(log::Level::Debug);
+        record(log::Level::Debug);
+
+        let stats = &logger.handle().stats()[0];
+        assert_eq!((stats.emitted, stats.sampled_out), (1, 2));
+    }
+
+    #[test]
+    fn test_rate_limit() {
+        let logger = OsLogger::new("com.example.oslog")
+            .level_filter(LevelFilter::Trace)
+            .category_rate_limit("Limited", RateLimit::per_second(1).burst(2));
+
+        for _ in 0..10 {
+            logger.log(
+                &Record::builder()
+                    .level(log::Level::Error)
+                    .target("Limited")
+                    .args(format_args!("Error"))
+                    .build(),
+            );
+        }
+
+        let suppressed = logger.registry.with("Limited", |category| {
+            category.unwrap().limiter.as_ref().unwrap().suppressed()
+        });
+
+        assert_eq!(suppressed, 8);
+
+        // Flushing summarizes them, without waiting for another record.
+        logger.flush();
+
+        let suppressed = logger.registry.with("Limited", |category| {
+            category.unwrap().limiter.as_ref().unwrap().suppressed()
+        });
+
+        assert_eq!(suppressed, 0);
+    }
+
+    #[test]
+    fn test_asynchronous() {
+        let logger = OsLogger::new("com.example.oslog")
+            .level_filter(LevelFilter::Trace)
+            .overflow(Overflow::Block)
+            .asynchronous(4);
+
+        for i in 0..100 {
+            logger.log(
+                &Record::builder()
+                    .level(log::Level::Error)
+                    .target("Asynchronous")
+                    .args(format_args!("Error {}", i))
+                    .build(),
+            );
+        }
+
+        logger.flush();
+        assert_eq!(logger.emitter.as_ref().unwrap().dropped(), 0);
+    }
+
+    #[test]
+    fn test_dropped_stats() {
+        let logger = OsLogger::new("com.example.oslog")
+            .collect_stats(true)
+            .level_filter(LevelFilter::Trace)
+            .asynchronous(2);
+
+        for i in 0..1000 {
+            logger.log(
+                &Record::builder()
+                    .level(log::Level::Error)
+                    .target("Dropped")
+                    .args(format_args!("Error {}", i))
+                    .build(),
+            );
+        }
+
+        logger.flush();
+
+        let stats = logger.handle().stats();
+        let dropped = logger.emitter.as_ref().unwrap().dropped() as u64;
+        assert_eq!(
+            (stats[0].emitted, stats[0].dropped),
+            (1000 - dropped, dropped)
+        );
+    }
 }
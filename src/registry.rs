@@ -0,0 +1,934 @@
+use crate::limiter::{Limiter, RateLimit};
+use crate::sampler::{Sampler, Sampling};
+use crate::stats::{CategoryStats, Stats};
+use crate::{static_level_filter, OsLog};
+use log::LevelFilter;
+use std::cell::{Cell, RefCell};
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicU8, AtomicUsize, Ordering};
+use std::sync::{Arc, PoisonError, RwLock, RwLockWriteGuard};
+use std::time::{Duration, Instant};
+
+/// A log for a single target along with its level filter, sampling and rate
+/// limit, if it has them.
+pub(crate) struct Category {
+    /// A `LevelFilter`, or `NO_LEVEL`. It's atomic so it can be changed while
+    /// the category is in use without replacing it.
+    level: AtomicU8,
+    /// Which `log::Level`s are enabled, one bit each in the low byte, with
+    /// the registry's epoch they were worked out in above it. They're worked
+    /// out again the first time the category is used in a new epoch.
+    enabled: AtomicU64,
+    /// Set when the category is used, and cleared as the eviction clock
+    /// passes it.
+    referenced: AtomicBool,
+    pub limiter: Option<Limiter>,
+    pub sampler: Option<Sampler>,
+    /// Only kept if the registry collects stats. Shared with any category
+    /// which replaces this one, so the counts aren't lost.
+    pub stats: Option<Arc<Stats>>,
+    pub log: OsLog,
+}
+
+const NO_LEVEL: u8 = u8::MAX;
+
+/// The category records go to when the registry is full of categories which
+/// can't be evicted.
+pub(crate) const OVERFLOW_CATEGORY: &str = "overflow";
+
+impl Category {
+    pub fn new(log: OsLog) -> Self {
+        Self {
+            level: AtomicU8::new(NO_LEVEL),
+            // Epoch 0 is never current, so the first use works them out.
+            enabled: AtomicU64::new(0),
+            referenced: AtomicBool::new(true),
+            limiter: None,
+            sampler: None,
+            stats: None,
+            log,
+        }
+    }
+
+    /// Whether records at `level` are logged, both by the category's filter,
+    /// or the registry's if it has none, and by the OS. Usually a single load
+    /// and AND.
+    #[inline]
+    pub fn is_enabled(&self, level: log::Level, epoch: u64, registry: &Registry) -> bool {
+        let mut enabled = self.enabled.load(Ordering::Relaxed);
+
+        if enabled >> 8 != epoch {
+            enabled = epoch << 8 | self.enabled_levels(registry.level()) as u64;
+            self.enabled.store(enabled, Ordering::Relaxed);
+        }
+
+        enabled & 1 << level as usize != 0
+    }
+
+    /// Works out which levels are enabled in `epoch` straight away, returning
+    /// whether they've changed since they were last worked out.
+    #[cfg(feature = "tracing")]
+    fn update_enabled(&self, epoch: u64, default: LevelFilter) -> bool {
+        let levels = self.enabled_levels(default);
+        let previous = self
+            .enabled
+            .swap(epoch << 8 | levels as u64, Ordering::Relaxed);
+
+        previous as u8 != levels
+    }
+
+    #[cold]
+    fn enabled_levels(&self, default: LevelFilter) -> u8 {
+        let filter = self.level().unwrap_or(default).min(static_level_filter());
+
+        log::Level::iter()
+            .filter(|&level| level <= filter && self.log.level_is_enabled(level.into()))
+            .fold(0, |mask, level| mask | 1 << level as usize)
+    }
+
+    /// Marks the category as recently used. It's only written when it isn't
+    /// marked already, so threads logging to it don't fight over the line.
+    #[inline]
+    fn touch(&self) {
+        if !self.referenced.load(Ordering::Relaxed) {
+            self.referenced.store(true, Ordering::Relaxed);
+        }
+    }
+
+    /// Categories with their own settings are never evicted, since the
+    /// settings would be lost.
+    fn is_pinned(&self) -> bool {
+        self.level().is_some() || self.limiter.is_some() || self.sampler.is_some()
+    }
+
+    #[inline]
+    pub fn level(&self) -> Option<LevelFilter> {
+        decode_level(self.level.load(Ordering::Relaxed))
+    }
+
+    pub fn set_level(&self, level: Option<LevelFilter>) {
+        let level = level.map_or(NO_LEVEL, |level| level as usize as u8);
+        self.level.store(level, Ordering::Relaxed);
+    }
+}
+
+#[inline]
+fn decode_level(level: u8) -> Option<LevelFilter> {
+    match level {
+        0 => Some(LevelFilter::Off),
+        1 => Some(LevelFilter::Error),
+        2 => Some(LevelFilter::Warn),
+        3 => Some(LevelFilter::Info),
+        4 => Some(LevelFilter::Debug),
+        5 => Some(LevelFilter::Trace),
+        _ => None,
+    }
+}
+
+/// Maps targets to their categories.
+///
+/// Categories are written rarely, when a target is first seen or has its
+/// filter set, but are read for every record. Each thread therefore keeps its
+/// own cache of the categories it has used, and only takes the shared lock on
+/// a miss. Replacing or evicting a category bumps the generation, which tells
+/// every thread to discard its cache the next time it looks something up, so
+/// the category's log is released once nothing else is using it.
+///
+/// The number of categories can be bounded, for programs whose targets are
+/// built at run time. Once it's reached, categories are evicted with the
+/// CLOCK algorithm, which approximates least recently used without any
+/// bookkeeping on lookups beyond setting a flag.
+///
+/// Which levels each category has enabled is cached in the category, and
+/// worked out again whenever the epoch moves on: when a filter changes, when
+/// asked to, and at least every refresh interval so changes to the system's
+/// logging configuration are picked up.
+pub(crate) struct Registry {
+    id: usize,
+    generation: AtomicUsize,
+    capacity: AtomicUsize,
+    categories: RwLock<Categories>,
+    epoch: AtomicU64,
+    started: Instant,
+    /// In nanoseconds since `started`.
+    refresh_interval: AtomicU64,
+    next_refresh: AtomicU64,
+    /// Whether new categories keep stats.
+    stats: AtomicBool,
+    /// The level filter of categories without their own, as in `Category`.
+    level: AtomicU8,
+    /// Whether a logger using the registry is installed, in which case its
+    /// level filter is `log`'s max level too.
+    installed: AtomicBool,
+    /// Whether a layer uses the registry, in which case `tracing`'s interest
+    /// is rebuilt when a refresh finds the OS collects different levels.
+    #[cfg(feature = "tracing")]
+    interest: AtomicBool,
+}
+
+/// How often the OS is asked which levels are enabled by default.
+const DEFAULT_REFRESH_INTERVAL: Duration = Duration::from_secs(1);
+
+/// The clock is only read once in this many calls to `epoch` on each thread.
+const TICKS_PER_CLOCK_CHECK: u32 = 256;
+
+pub(crate) struct Categories {
+    map: HashMap<String, Arc<Category>>,
+    /// The map's keys, in the order the clock hand visits them.
+    clock: Vec<String>,
+    hand: usize,
+    /// Created the first time the registry is full and nothing can be
+    /// evicted.
+    overflow: Option<Arc<Category>>,
+    /// The generation in which nothing could be evicted, until something
+    /// might be evictable again. New targets go straight to the overflow
+    /// category until then, without another scan.
+    full: Option<usize>,
+}
+
+impl Categories {
+    fn insert(&mut self, target: &str, category: Arc<Category>) -> Option<Arc<Category>> {
+        let replaced = self.map.insert(target.into(), category);
+
+        if replaced.is_none() {
+            self.clock.push(target.into());
+        }
+
+        replaced
+    }
+
+    /// Evicts the first category the hand reaches which is neither pinned nor
+    /// referenced, clearing the flags of the referenced ones it passes on the
+    /// way. Returns false if every category is pinned.
+    fn evict(&mut self) -> bool {
+        // Two passes clear every flag, so this only gives up if the
+        // categories which are left are all pinned.
+        for _ in 0..2 * self.clock.len() {
+            if self.hand >= self.clock.len() {
+                self.hand = 0;
+            }
+
+            let category = &self.map[&self.clock[self.hand]];
+
+            if category.is_pinned() || category.referenced.swap(false, Ordering::Relaxed) {
+                self.hand += 1;
+                continue;
+            }
+
+            // The hand is left where it is, on the key swapped into this slot.
+            let target = self.clock.swap_remove(self.hand);
+            self.map.remove(&target);
+            return true;
+        }
+
+        false
+    }
+
+    /// The overflow category, if new targets would still go to it.
+    fn overflowing(&self, generation: usize) -> Option<&Arc<Category>> {
+        match self.full {
+            Some(full) if full == generation => self.overflow.as_ref(),
+            _ => None,
+        }
+    }
+}
+
+/// Identifies which registry, and which generation of it, each of a thread's
+/// caches holds, since a program can log through both a logger and a layer
+/// with their own registries, and tests and the like create many.
+static NEXT_REGISTRY_ID: AtomicUsize = AtomicUsize::new(0);
+
+/// The most registries a thread caches categories for at once. Beyond that,
+/// the one it cached first is discarded.
+const CACHED_REGISTRIES: usize = 4;
+
+struct ThreadCache {
+    registry: usize,
+    generation: usize,
+    categories: HashMap<Box<str>, Arc<Category>>,
+}
+
+thread_local! {
+    static CACHE: RefCell<Vec<ThreadCache>> = const { RefCell::new(Vec::new()) };
+
+    static TICKS: Cell<u32> = const { Cell::new(0) };
+}
+
+impl Registry {
+    pub fn new() -> Self {
+        Self {
+            id: NEXT_REGISTRY_ID.fetch_add(1, Ordering::Relaxed),
+            generation: AtomicUsize::new(0),
+            capacity: AtomicUsize::new(usize::MAX),
+            categories: RwLock::new(Categories {
+                map: HashMap::new(),
+                clock: Vec::new(),
+                hand: 0,
+                overflow: None,
+                full: None,
+            }),
+            epoch: AtomicU64::new(1),
+            started: Instant::now(),
+            refresh_interval: AtomicU64::new(DEFAULT_REFRESH_INTERVAL.as_nanos() as u64),
+            next_refresh: AtomicU64::new(DEFAULT_REFRESH_INTERVAL.as_nanos() as u64),
+            stats: AtomicBool::new(false),
+            level: AtomicU8::new(LevelFilter::Trace.min(static_level_filter()) as usize as u8),
+            installed: AtomicBool::new(false),
+            #[cfg(feature = "tracing")]
+            interest: AtomicBool::new(false),
+        }
+    }
+
+    /// The level filter of categories without their own.
+    #[inline]
+    pub fn level(&self) -> LevelFilter {
+        decode_level(self.level.load(Ordering::Relaxed)).unwrap_or(LevelFilter::Off)
+    }
+
+    /// Sets the level filter of categories without their own, and `log`'s max
+    /// level if a logger using the registry is installed. Levels which have
+    /// been compiled out stay disabled.
+    pub fn set_level_filter(&self, level: LevelFilter) {
+        let level = level.min(static_level_filter());
+        self.level.store(level as usize as u8, Ordering::Relaxed);
+
+        if self.installed.load(Ordering::Relaxed) {
+            log::set_max_level(level);
+        }
+
+        self.refresh();
+    }
+
+    /// Marks the registry as used by a layer, whose callsites' interest depends
+    /// on which levels each category has enabled.
+    #[cfg(feature = "tracing")]
+    pub fn track_interest(&self) {
+        self.interest.store(true, Ordering::Relaxed);
+    }
+
+    /// Marks a logger using the registry as installed, so `log` passes it the
+    /// levels enabled by the registry's level filter.
+    pub fn install(&self) {
+        self.installed.store(true, Ordering::Relaxed);
+        log::set_max_level(self.level());
+    }
+
+    fn category(&self, log: OsLog) -> Category {
+        let mut category = Category::new(log);
+
+        if self.stats.load(Ordering::Relaxed) {
+            category.stats = Some(Arc::default());
+        }
+
+        category
+    }
+
+    /// Starts or stops keeping stats for every category, creating any which
+    /// are still in use by a thread's cache again with `log`, which is passed
+    /// the category's name.
+    pub fn set_stats(&self, enabled: bool, log: impl Fn(&str) -> OsLog) {
+        self.stats.store(enabled, Ordering::Relaxed);
+
+        let targets: Vec<String> = self
+            .categories
+            .read()
+            .unwrap()
+            .map
+            .keys()
+            .cloned()
+            .collect();
+
+        for target in targets {
+            self.configure(
+                &target,
+                || log(&target),
+                |category| {
+                    if category.stats.is_some() != enabled {
+                        category.stats = if enabled { Some(Arc::default()) } else { None };
+                    }
+                },
+            );
+        }
+    }
+
+    /// The epoch to check categories' enabled levels against, which moves on
+    /// by itself once the refresh interval has passed.
+    #[inline]
+    pub fn epoch(&self) -> u64 {
+        let check = TICKS
+            .try_with(|ticks| {
+                let tick = ticks.get().wrapping_add(1);
+                ticks.set(tick);
+                tick % TICKS_PER_CLOCK_CHECK == 0
+            })
+            .unwrap_or(false);
+
+        if check {
+            self.check_clock();
+        }
+
+        self.current_epoch()
+    }
+
+    /// The epoch, without checking whether the refresh interval has passed.
+    #[inline]
+    pub fn current_epoch(&self) -> u64 {
+        self.epoch.load(Ordering::Relaxed)
+    }
+
+    #[cold]
+    fn check_clock(&self) {
+        let now = self.started.elapsed().as_nanos() as u64;
+        let next = self.next_refresh.load(Ordering::Relaxed);
+
+        if now >= next {
+            let interval = self.refresh_interval.load(Ordering::Relaxed);
+
+            // Only the thread which moves the deadline on starts the epoch.
+            if self
+                .next_refresh
+                .compare_exchange(next, now + interval, Ordering::Relaxed, Ordering::Relaxed)
+                .is_ok()
+            {
+                self.refresh();
+
+                #[cfg(feature = "tracing")]
+                if self.interest.load(Ordering::Relaxed) && self.update_enabled_levels() {
+                    tracing_core::callsite::rebuild_interest_cache();
+                }
+            }
+        }
+    }
+
+    /// Works out which levels every category has enabled in the new epoch
+    /// straight away, rather than when each is next used, since callsites
+    /// `tracing` has disabled won't use theirs. Returns whether any changed.
+    #[cfg(feature = "tracing")]
+    #[cold]
+    fn update_enabled_levels(&self) -> bool {
+        let epoch = self.current_epoch();
+        let default = self.level();
+        let categories = self.categories.read().unwrap();
+        let mut changed = false;
+
+        for category in categories.map.values().chain(&categories.overflow) {
+            changed |= category.update_enabled(epoch, default);
+        }
+
+        changed
+    }
+
+    /// Makes every category work out which levels it has enabled again the
+    /// next time it's used.
+    pub fn refresh(&self) {
+        self.epoch.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn set_refresh_interval(&self, interval: Duration) {
+        let interval = (interval.as_nanos() as u64).max(1);
+        let now = self.started.elapsed().as_nanos() as u64;
+
+        self.refresh_interval.store(interval, Ordering::Relaxed);
+        self.next_refresh.store(now + interval, Ordering::Relaxed);
+    }
+
+    /// Takes the lock on the categories, so no other thread can be holding it
+    /// when the process forks.
+    pub fn lock_for_fork(&self) -> RwLockWriteGuard<'_, Categories> {
+        self.categories
+            .write()
+            .unwrap_or_else(PoisonError::into_inner)
+    }
+
+    /// Bounds the number of categories which are kept, evicting any over it
+    /// straight away.
+    pub fn set_capacity(&self, capacity: usize) {
+        let capacity = capacity.max(1);
+        self.capacity.store(capacity, Ordering::Relaxed);
+
+        let mut categories = self.categories.write().unwrap();
+        let mut evicted = false;
+        categories.full = None;
+
+        while categories.map.len() > capacity && categories.evict() {
+            evicted = true;
+        }
+
+        if evicted {
+            self.generation.fetch_add(1, Ordering::Release);
+        }
+    }
+
+    /// Calls `f` with the target's category, or `None` if it doesn't have one.
+    /// Once the registry is full of categories which can't be evicted, targets
+    /// without one get the overflow category instead.
+    pub fn with<R>(&self, target: &str, f: impl FnOnce(Option<&Arc<Category>>) -> R) -> R {
+        let generation = self.generation.load(Ordering::Acquire);
+        let mut f = Some(f);
+
+        // The borrow fails if something being logged logs too, and the access
+        // fails while the thread is being torn down. Both take the slow path.
+        let hit = CACHE
+            .try_with(|cache| {
+                let caches = cache.try_borrow().ok()?;
+                let cache = caches.iter().find(|cache| cache.registry == self.id)?;
+
+                if cache.generation != generation {
+                    return None;
+                }
+
+                let category = cache.categories.get(target)?;
+                category.touch();
+                f.take().map(|f| f(Some(category)))
+            })
+            .ok()
+            .flatten();
+
+        if let Some(result) = hit {
+            return result;
+        }
+
+        let f = f.take().unwrap();
+        let categories = self.categories.read().unwrap();
+
+        if let Some(category) = categories.map.get(target).cloned() {
+            drop(categories);
+            category.touch();
+            self.cache(target, generation, &category);
+            return f(Some(&category));
+        }
+
+        // Not cached, since each thread's cache would otherwise grow with
+        // every target which overflows, but this skips the write lock and the
+        // scan for something to evict.
+        let overflow = categories.overflowing(generation).cloned();
+        drop(categories);
+        f(overflow.as_ref())
+    }
+
+    /// Returns the target's category, creating it with `log`, which is passed
+    /// the category's name, and no level filter if it doesn't exist yet. If
+    /// the registry is full a category is evicted to make room, or if they're
+    /// all pinned the overflow category is returned instead.
+    pub fn get_or_insert(&self, target: &str, log: impl FnOnce(&str) -> OsLog) -> Arc<Category> {
+        let mut generation = self.generation.load(Ordering::Acquire);
+        let mut categories = self.categories.write().unwrap();
+
+        if let Some(category) = categories.map.get(target) {
+            let category = category.clone();
+            drop(categories);
+            self.cache(target, generation, &category);
+            return category;
+        }
+
+        if categories.map.len() >= self.capacity.load(Ordering::Relaxed) {
+            if let Some(overflow) = categories.overflowing(generation) {
+                return overflow.clone();
+            }
+
+            if !categories.evict() {
+                // Not cached, as in `with`.
+                categories.full = Some(generation);
+                return categories
+                    .overflow
+                    .get_or_insert_with(|| Arc::new(self.category(log(OVERFLOW_CATEGORY))))
+                    .clone();
+            }
+
+            // Caches which still hold the evicted category are discarded,
+            // including this thread's once the new category is added to it.
+            generation = self.generation.fetch_add(1, Ordering::Release) + 1;
+        }
+
+        let category = Arc::new(self.category(log(target)));
+        categories.insert(target, category.clone());
+        drop(categories);
+
+        self.cache(target, generation, &category);
+        category
+    }
+
+    /// Sets, updates or clears the target's level filter, creating the
+    /// category with `log` if it doesn't exist yet. An existing category is
+    /// updated in place, so threads which have cached it see the new filter
+    /// straight away.
+    pub fn set_level(&self, target: &str, level: Option<LevelFilter>, log: impl FnOnce() -> OsLog) {
+        let existing = self.categories.read().unwrap().map.get(target).cloned();
+
+        if let Some(category) = existing {
+            category.set_level(level);
+
+            // It may be evictable now, so new targets could have room again.
+            if level.is_none() {
+                self.categories.write().unwrap().full = None;
+            }
+
+            return self.refresh();
+        }
+
+        self.configure(target, log, |category| category.set_level(level));
+    }
+
+    /// Sets or updates the target's rate limit, creating the category with
+    /// `log` if it doesn't exist yet or is still in use by a thread's cache.
+    pub fn set_limit(&self, target: &str, limit: RateLimit, log: impl FnOnce() -> OsLog) {
+        self.configure(target, log, |category| {
+            category.limiter = Some(Limiter::new(limit))
+        });
+    }
+
+    /// Sets or updates the sampling of the target's records at `level` and
+    /// more verbose ones, creating the category with `log` if it doesn't
+    /// exist yet or is still in use by a thread's cache.
+    pub fn set_sampling(
+        &self,
+        target: &str,
+        level: LevelFilter,
+        sampling: Sampling,
+        log: impl FnOnce() -> OsLog,
+    ) {
+        self.configure(target, log, |category| {
+            category.sampler = Some(Sampler::new(level, sampling))
+        });
+    }
+
+    fn configure(&self, target: &str, log: impl FnOnce() -> OsLog, f: impl FnOnce(&mut Category)) {
+        let mut categories = self.categories.write().unwrap();
+        categories.full = None;
+        let existing = categories.map.get_mut(target);
+
+        if let Some(category) = existing.and_then(Arc::get_mut) {
+            return f(category);
+        }
+
+        // The replacement keeps the existing category's settings, although a
+        // rate limit or sampling count starts over.
+        let mut category = self.category(log());
+
+        if let Some(existing) = categories.map.get(target) {
+            category.set_level(existing.level());
+            category.limiter = existing
+                .limiter
+                .as_ref()
+                .map(|limiter| Limiter::new(limiter.limit()));
+            category.sampler = existing
+                .sampler
+                .as_ref()
+                .map(|sampler| Sampler::new(sampler.level, sampler.sampling));
+            category.stats = existing.stats.clone();
+        }
+
+        f(&mut category);
+
+        // Configured categories are pinned, so they can go over the capacity.
+        if categories.insert(target, Arc::new(category)).is_some() {
+            self.generation.fetch_add(1, Ordering::Release);
+        }
+    }
+
+    /// Adds the category to this thread's cache for the registry, clearing it
+    /// first if it belongs to another generation.
+    fn cache(&self, target: &str, generation: usize, category: &Arc<Category>) {
+        let _ = CACHE.try_with(|caches| {
+            let mut caches = match caches.try_borrow_mut() {
+                Ok(caches) => caches,
+                Err(_) => return,
+            };
+
+            let index = match caches.iter().position(|cache| cache.registry == self.id) {
+                Some(index) => index,
+                None => {
+                    if caches.len() == CACHED_REGISTRIES {
+                        caches.remove(0);
+                    }
+
+                    caches.push(ThreadCache {
+                        registry: self.id,
+                        generation,
+                        categories: HashMap::new(),
+                    });
+                    caches.len() - 1
+                }
+            };
+
+            let cache = &mut caches[index];
+
+            if cache.generation != generation {
+                cache.generation = generation;
+                cache.categories.clear();
+            }
+
+            cache.categories.insert(target.into(), category.clone());
+        });
+    }
+
+    /// Snapshots the counters of every category which keeps them, including
+    /// the overflow one if it has been used.
+    pub fn stats(&self) -> Vec<CategoryStats> {
+        let categories = self.categories.read().unwrap();
+        let overflow = categories
+            .overflow
+            .iter()
+            .map(|category| (OVERFLOW_CATEGORY, category));
+
+        categories
+            .map
+            .iter()
+            .map(|(target, category)| (target.as_str(), category))
+            .chain(overflow)
+            .filter_map(|(target, category)| Some(category.stats.as_ref()?.snapshot(target)))
+            .collect()
+    }
+
+    /// Calls `f` with every category which has a rate limit, and its limiter.
+    pub fn for_each_limited(&self, mut f: impl FnMut(&Arc<Category>, &Limiter)) {
+        let categories = self.categories.read().unwrap();
+
+        for category in categories.map.values() {
+            if let Some(limiter) = &category.limiter {
+                f(category, limiter);
+            }
+        }
+    }
+
+    #[cfg(test)]
+    pub fn len(&self) -> usize {
+        self.categories.read().unwrap().map.len()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn new_log() -> OsLog {
+        OsLog::new("com.example.oslog", "registry")
+    }
+
+    fn level(registry: &Registry, target: &str) -> Option<LevelFilter> {
+        registry.with(target, |category| category.and_then(|c| c.level()))
+    }
+
+    #[test]
+    fn test_insert_and_lookup() {
+        let registry = Registry::new();
+        assert!(registry.with("Missing", |category| category.is_none()));
+
+        registry.get_or_insert("Inserted", |_| new_log());
+        registry.get_or_insert("Inserted", |_| unreachable!());
+
+        assert_eq!(registry.len(), 1);
+        assert!(registry.with("Inserted", |category| category.is_some()));
+        assert!(registry.with("Missing", |category| category.is_none()));
+    }
+
+    #[test]
+    fn test_set_level_updates_caches() {
+        let registry = Registry::new();
+        registry.set_level("Level", Some(LevelFilter::Warn), new_log);
+        assert_eq!(level(&registry, "Level"), Some(LevelFilter::Warn));
+
+        // The category is cached by this thread now, and is updated in place.
+        let generation = registry.generation.load(Ordering::Relaxed);
+        registry.set_level("Level", Some(LevelFilter::Trace), || unreachable!());
+        assert_eq!(level(&registry, "Level"), Some(LevelFilter::Trace));
+        assert_eq!(registry.generation.load(Ordering::Relaxed), generation);
+
+        std::thread::scope(|scope| {
+            scope.spawn(|| assert_eq!(level(&registry, "Level"), Some(LevelFilter::Trace)));
+        });
+
+        registry.set_level("Level", None, || unreachable!());
+        assert_eq!(level(&registry, "Level"), None);
+        assert!(registry.with("Level", |category| category.is_some()));
+    }
+
+    #[test]
+    fn test_replacement_keeps_settings() {
+        let registry = Registry::new();
+        registry.set_limit("Limited", RateLimit::per_second(1), new_log);
+        registry.set_level("Limited", Some(LevelFilter::Warn), new_log);
+
+        // Cached now, so the next change replaces the category.
+        assert_eq!(level(&registry, "Limited"), Some(LevelFilter::Warn));
+        registry.set_limit("Limited", RateLimit::per_second(2), new_log);
+
+        registry.with("Limited", |category| {
+            let category = category.unwrap();
+            assert_eq!(category.level(), Some(LevelFilter::Warn));
+            assert_eq!(
+                category.limiter.as_ref().map(|l| l.limit()),
+                Some(RateLimit::per_second(2))
+            );
+        });
+    }
+
+    #[test]
+    fn test_eviction() {
+        let registry = Registry::new();
+        registry.set_capacity(2);
+
+        let first = registry.get_or_insert("First", |_| new_log());
+        registry.get_or_insert("Second", |_| new_log());
+        let generation = registry.generation.load(Ordering::Relaxed);
+
+        // Both are referenced, so the hand clears them and comes back round
+        // to the first.
+        registry.get_or_insert("Third", |_| new_log());
+        assert_eq!(registry.len(), 2);
+        assert!(registry.generation.load(Ordering::Relaxed) > generation);
+        assert!(registry.with("First", |category| category.is_none()));
+
+        // Only this test's handle is left once the caches have moved on.
+        assert_eq!(Arc::strong_count(&first), 1);
+
+        // The third was just used, so the second goes next.
+        registry.with("Third", |category| assert!(category.is_some()));
+        registry.get_or_insert("Fourth", |_| new_log());
+        assert!(registry.with("Second", |category| category.is_none()));
+        assert!(registry.with("Third", |category| category.is_some()));
+    }
+
+    #[test]
+    fn test_overflow() {
+        let registry = Registry::new();
+        registry.set_level("First", Some(LevelFilter::Warn), new_log);
+        registry.set_level("Second", Some(LevelFilter::Warn), new_log);
+        registry.get_or_insert("Third", |_| new_log());
+
+        // Shrinking evicts what it can, but configured categories stay.
+        registry.set_capacity(1);
+        assert_eq!(registry.len(), 2);
+        assert!(registry.with("Third", |category| category.is_none()));
+
+        let mut names = Vec::new();
+        let overflow = registry.get_or_insert("Dynamic", |name| {
+            names.push(name.to_string());
+            new_log()
+        });
+        let again = registry.get_or_insert("Other", |_| unreachable!());
+
+        assert_eq!(names, [OVERFLOW_CATEGORY]);
+        assert!(Arc::ptr_eq(&overflow, &again));
+        assert_eq!(registry.len(), 2);
+
+        // Lookups go straight to the overflow category while it's full.
+        registry.with("Dynamic", |category| {
+            assert!(Arc::ptr_eq(category.unwrap(), &overflow))
+        });
+
+        // Clearing a filter makes its category evictable, so there's room.
+        registry.set_level("First", None, || unreachable!());
+        assert!(registry.with("Dynamic", |category| category.is_none()));
+
+        let dynamic = registry.get_or_insert("Dynamic", |_| new_log());
+        assert!(!Arc::ptr_eq(&dynamic, &overflow));
+        assert!(registry.with("First", |category| category.is_none()));
+    }
+
+    #[test]
+    fn test_enabled_levels() {
+        let registry = Registry::new();
+        registry.set_level("Enabled", Some(LevelFilter::Warn), new_log);
+        let category = registry.get_or_insert("Enabled", |_| unreachable!());
+
+        let epoch = registry.epoch();
+        assert!(category.is_enabled(log::Level::Error, epoch, &registry));
+        assert!(!category.is_enabled(log::Level::Info, epoch, &registry));
+
+        // Cached until the epoch moves on, which changing the filter does.
+        category.set_level(Some(LevelFilter::Info));
+        assert!(!category.is_enabled(log::Level::Info, epoch, &registry));
+
+        registry.set_level("Enabled", Some(LevelFilter::Info), || unreachable!());
+        let epoch = registry.epoch();
+        assert!(category.is_enabled(log::Level::Info, epoch, &registry));
+        assert!(!category.is_enabled(log::Level::Debug, epoch, &registry));
+
+        // Categories without a filter of their own use the registry's.
+        let unfiltered = registry.get_or_insert("Unfiltered", |_| new_log());
+        assert!(unfiltered.is_enabled(log::Level::Info, registry.epoch(), &registry));
+
+        registry.set_level_filter(LevelFilter::Warn);
+        assert_eq!(registry.level(), LevelFilter::Warn);
+        assert!(!unfiltered.is_enabled(log::Level::Info, registry.epoch(), &registry));
+        assert!(category.is_enabled(log::Level::Info, registry.epoch(), &registry));
+    }
+
+    #[cfg(feature = "tracing")]
+    #[test]
+    fn test_update_enabled_levels() {
+        let registry = Registry::new();
+        let category = registry.get_or_insert("Updated", |_| new_log());
+        assert!(category.is_enabled(log::Level::Info, registry.epoch(), &registry));
+
+        // Nothing changed, so callsites' interest can be left alone.
+        registry.refresh();
+        assert!(!registry.update_enabled_levels());
+
+        category.set_level(Some(LevelFilter::Warn));
+        registry.refresh();
+        assert!(registry.update_enabled_levels());
+        assert!(!category.is_enabled(log::Level::Info, registry.current_epoch(), &registry));
+    }
+
+    #[test]
+    fn test_refresh_interval() {
+        let registry = Registry::new();
+        registry.set_refresh_interval(Duration::from_nanos(1));
+        let epoch = registry.epoch();
+
+        std::thread::sleep(Duration::from_millis(1));
+
+        for _ in 0..TICKS_PER_CLOCK_CHECK {
+            registry.epoch();
+        }
+
+        assert!(registry.epoch() > epoch);
+    }
+
+    #[test]
+    fn test_separate_registries() {
+        let first = Registry::new();
+        let second = Registry::new();
+        first.set_level("Shared", Some(LevelFilter::Warn), new_log);
+        second.set_level("Shared", Some(LevelFilter::Error), new_log);
+
+        assert_eq!(level(&first, "Shared"), Some(LevelFilter::Warn));
+        assert_eq!(level(&second, "Shared"), Some(LevelFilter::Error));
+        assert_eq!(level(&first, "Shared"), Some(LevelFilter::Warn));
+    }
+
+    #[test]
+    fn test_alternating_registries() {
+        use crate::counting::allocations;
+
+        let first = Registry::new();
+        let second = Registry::new();
+        first.get_or_insert("First", |_| new_log());
+        second.get_or_insert("Second", |_| new_log());
+
+        // Both stay cached, so switching between them doesn't allocate.
+        let count = allocations(|| {
+            for _ in 0..100 {
+                assert!(first.with("First", |category| category.is_some()));
+                assert!(second.with("Second", |category| category.is_some()));
+            }
+        });
+
+        assert_eq!(count, 0);
+    }
+
+    #[test]
+    fn test_reentrant_lookup() {
+        let registry = Registry::new();
+        registry.get_or_insert("Outer", |_| new_log());
+        registry.get_or_insert("Outer", |_| unreachable!());
+
+        registry.with("Outer", |outer| {
+            assert!(outer.is_some());
+            registry.get_or_insert("Inner", |_| new_log());
+            assert!(registry.with("Inner", |inner| inner.is_some()));
+        });
+    }
+}
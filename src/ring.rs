@@ -0,0 +1,204 @@
+use std::cell::UnsafeCell;
+use std::mem::MaybeUninit;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+/// Keeps the producers' and consumer's positions on separate cache lines.
+#[repr(align(128))]
+struct Padded(AtomicUsize);
+
+struct Slot<T> {
+    /// Equal to the slot's position when it's free to be written, and one past
+    /// it once it holds a value which is ready to be read.
+    sequence: AtomicUsize,
+    value: UnsafeCell<MaybeUninit<T>>,
+}
+
+/// A bounded lock free queue for any number of producers and one consumer,
+/// after Dmitry Vyukov's bounded MPMC queue.
+pub(crate) struct Ring<T> {
+    slots: Box<[Slot<T>]>,
+    mask: usize,
+    head: Padded,
+    tail: Padded,
+}
+
+unsafe impl<T: Send> Send for Ring<T> {}
+unsafe impl<T: Send> Sync for Ring<T> {}
+
+impl<T> Ring<T> {
+    /// Creates a ring which holds at least `capacity` values.
+    pub fn new(capacity: usize) -> Self {
+        let capacity = capacity.max(2).next_power_of_two();
+
+        let slots = (0..capacity)
+            .map(|i| Slot {
+                sequence: AtomicUsize::new(i),
+                value: UnsafeCell::new(MaybeUninit::uninit()),
+            })
+            .collect();
+
+        Self {
+            slots,
+            mask: capacity - 1,
+            head: Padded(AtomicUsize::new(0)),
+            tail: Padded(AtomicUsize::new(0)),
+        }
+    }
+
+    #[cfg(test)]
+    pub fn capacity(&self) -> usize {
+        self.slots.len()
+    }
+
+    /// Adds a value, or hands it back if the ring is full.
+    pub fn push(&self, value: T) -> Result<(), T> {
+        let mut position = self.tail.0.load(Ordering::Relaxed);
+
+        loop {
+            let slot = &self.slots[position & self.mask];
+            let sequence = slot.sequence.load(Ordering::Acquire);
+            let difference = sequence.wrapping_sub(position) as isize;
+
+            if difference == 0 {
+                match self.tail.0.compare_exchange_weak(
+                    position,
+                    position.wrapping_add(1),
+                    Ordering::Relaxed,
+                    Ordering::Relaxed,
+                ) {
+                    Ok(_) => {
+                        unsafe { (*slot.value.get()).as_mut_ptr().write(value) };
+                        slot.sequence
+                            .store(position.wrapping_add(1), Ordering::Release);
+                        return Ok(());
+                    }
+                    Err(current) => position = current,
+                }
+            } else if difference < 0 {
+                return Err(value);
+            } else {
+                position = self.tail.0.load(Ordering::Relaxed);
+            }
+        }
+    }
+
+    /// Removes the oldest value.
+    ///
+    /// # Safety
+    ///
+    /// Only one thread may pop at a time.
+    pub unsafe fn pop(&self) -> Option<T> {
+        let position = self.head.0.load(Ordering::Relaxed);
+        let slot = &self.slots[position & self.mask];
+        let sequence = slot.sequence.load(Ordering::Acquire);
+
+        if sequence != position.wrapping_add(1) {
+            return None;
+        }
+
+        let value = (*slot.value.get()).as_ptr().read();
+        self.head
+            .0
+            .store(position.wrapping_add(1), Ordering::Relaxed);
+        slot.sequence
+            .store(position.wrapping_add(self.slots.len()), Ordering::Release);
+
+        Some(value)
+    }
+
+    /// The number of values which have ever been pushed, or are in the middle
+    /// of being pushed.
+    pub fn pushed(&self) -> usize {
+        self.tail.0.load(Ordering::Acquire)
+    }
+}
+
+impl<T> Drop for Ring<T> {
+    fn drop(&mut self) {
+        while unsafe { self.pop() }.is_some() {}
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::Arc;
+
+    #[test]
+    fn test_push_and_pop() {
+        let ring = Ring::new(3);
+        assert_eq!(ring.capacity(), 4);
+
+        for i in 0..4 {
+            ring.push(i).unwrap();
+        }
+
+        assert_eq!(ring.push(4), Err(4));
+
+        unsafe {
+            assert_eq!(ring.pop(), Some(0));
+            ring.push(4).unwrap();
+
+            for i in 1..5 {
+                assert_eq!(ring.pop(), Some(i));
+            }
+
+            assert_eq!(ring.pop(), None);
+        }
+
+        assert_eq!(ring.pushed(), 5);
+    }
+
+    #[test]
+    fn test_drops_remaining() {
+        let value = Arc::new(());
+        let ring = Ring::new(4);
+        ring.push(value.clone()).unwrap();
+        ring.push(value.clone()).unwrap();
+
+        drop(ring);
+        assert_eq!(Arc::strong_count(&value), 1);
+    }
+
+    #[test]
+    fn test_many_producers() {
+        const PRODUCERS: usize = 4;
+        const VALUES: usize = 10_000;
+
+        let ring = Ring::new(64);
+        let mut received = vec![0; PRODUCERS];
+
+        std::thread::scope(|scope| {
+            for producer in 0..PRODUCERS {
+                let ring = &ring;
+
+                scope.spawn(move || {
+                    for value in 0..VALUES {
+                        let mut pending = (producer, value);
+
+                        while let Err(rejected) = ring.push(pending) {
+                            pending = rejected;
+                            std::thread::yield_now();
+                        }
+                    }
+                });
+            }
+
+            let mut remaining = PRODUCERS * VALUES;
+
+            while remaining > 0 {
+                match unsafe { ring.pop() } {
+                    Some((producer, value)) => {
+                        // Each producer's values arrive in the order it sent them.
+                        assert_eq!(received[producer], value);
+                        received[producer] += 1;
+                        remaining -= 1;
+                    }
+                    None => std::thread::yield_now(),
+                }
+            }
+        });
+
+        assert_eq!(received, vec![VALUES; PRODUCERS]);
+    }
+}
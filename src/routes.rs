@@ -0,0 +1,89 @@
+use crate::OsLog;
+
+/// Maps targets to the subsystem their category is created in, by the longest
+/// prefix of the target which has been given one. The route is only looked up
+/// when a category is created, so it costs nothing once the category exists.
+#[derive(Clone)]
+pub(crate) struct Routes {
+    default: String,
+    /// Sorted by prefix, so every prefix of a target sorts before it, and
+    /// the longer of two prefixes of the same target sorts after the shorter.
+    prefixes: Vec<(String, String)>,
+}
+
+impl Routes {
+    pub fn new(subsystem: &str) -> Self {
+        Self {
+            default: subsystem.to_string(),
+            prefixes: Vec::new(),
+        }
+    }
+
+    /// Routes targets starting with `prefix` to `subsystem`, replacing any
+    /// route for the same prefix.
+    pub fn insert(&mut self, prefix: &str, subsystem: &str) {
+        match self
+            .prefixes
+            .binary_search_by(|(existing, _)| existing.as_str().cmp(prefix))
+        {
+            Ok(i) => self.prefixes[i].1 = subsystem.to_string(),
+            Err(i) => self
+                .prefixes
+                .insert(i, (prefix.to_string(), subsystem.to_string())),
+        }
+    }
+
+    pub fn subsystem(&self, target: &str) -> &str {
+        // Everything from here on sorts after the target, so can't be a
+        // prefix of it. Walking back, the first prefix of the target found is
+        // the longest one.
+        let end = self
+            .prefixes
+            .partition_point(|(prefix, _)| prefix.as_str() <= target);
+
+        self.prefixes[..end]
+            .iter()
+            .rev()
+            .find(|(prefix, _)| target.starts_with(prefix.as_str()))
+            .map_or(&self.default, |(_, subsystem)| subsystem)
+    }
+
+    /// Creates the log for a category in its target's subsystem.
+    pub fn log(&self, category: &str) -> OsLog {
+        OsLog::new(self.subsystem(category), category)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_longest_prefix() {
+        let mut routes = Routes::new("com.example.default");
+        routes.insert("net", "com.example.net");
+        routes.insert("net::tcp", "com.example.tcp");
+        routes.insert("netx", "com.example.netx");
+        routes.insert("db", "com.example.wrong");
+        routes.insert("db", "com.example.db");
+
+        assert_eq!(routes.subsystem("net"), "com.example.net");
+        assert_eq!(routes.subsystem("net::udp"), "com.example.net");
+        assert_eq!(routes.subsystem("net::tcp::listener"), "com.example.tcp");
+        assert_eq!(routes.subsystem("netx::a"), "com.example.netx");
+        assert_eq!(routes.subsystem("ne"), "com.example.default");
+        assert_eq!(routes.subsystem("db::pool"), "com.example.db");
+        assert_eq!(routes.subsystem("other"), "com.example.default");
+        assert_eq!(routes.subsystem(""), "com.example.default");
+    }
+
+    #[test]
+    fn test_empty_prefix() {
+        let mut routes = Routes::new("com.example.default");
+        routes.insert("", "com.example.everything");
+        routes.insert("net", "com.example.net");
+
+        assert_eq!(routes.subsystem("other"), "com.example.everything");
+        assert_eq!(routes.subsystem("net"), "com.example.net");
+    }
+}
@@ -0,0 +1,153 @@
+use log::LevelFilter;
+use std::cell::Cell;
+use std::collections::hash_map::RandomState;
+use std::hash::{BuildHasher, Hasher};
+use std::sync::atomic::{AtomicU64, Ordering};
+
+/// Keeps a sample of a category's records, so verbose levels can stay
+/// enabled on busy categories without the cost of logging all of them.
+///
+/// ```
+/// use oslog::Sampling;
+///
+/// // Keep every hundredth record.
+/// let sampling = Sampling::one_in(100);
+/// // Keep a random quarter of them.
+/// let sampling = Sampling::fraction(0.25);
+/// ```
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Sampling(Rate);
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Rate {
+    Every(u64),
+    /// Out of 2^32, so a whole fraction can be represented.
+    Random(u64),
+}
+
+impl Sampling {
+    /// Keeps exactly one record in `n`: the first, and every `n`th one after
+    /// it. The count is shared by every thread logging to the category.
+    pub fn one_in(n: u32) -> Self {
+        assert!(n > 0, "Sampling must keep at least one record in n");
+        Self(Rate::Every(n as u64))
+    }
+
+    /// Keeps a random `fraction` of the records, which is clamped to between
+    /// 0 and 1. Each record is kept or not independently, so the fraction is
+    /// only kept on average, but threads don't share anything to decide.
+    pub fn fraction(fraction: f64) -> Self {
+        let fraction = if fraction.is_nan() {
+            0.0
+        } else {
+            fraction.clamp(0.0, 1.0)
+        };
+
+        Self(Rate::Random((fraction * (1u64 << 32) as f64) as u64))
+    }
+}
+
+/// Samples the records of one category which are at `level` or more verbose,
+/// while keeping all of the less verbose ones.
+pub(crate) struct Sampler {
+    pub level: LevelFilter,
+    pub sampling: Sampling,
+    /// How many records `Rate::Every` has seen.
+    count: AtomicU64,
+}
+
+thread_local! {
+    /// Xorshift state, seeded on first use. Never zero once seeded.
+    static STATE: Cell<u64> = const { Cell::new(0) };
+}
+
+/// A random number from this thread's xorshift generator.
+#[inline]
+fn next() -> u64 {
+    STATE
+        .try_with(|state| {
+            let mut x = state.get();
+
+            if x == 0 {
+                x = RandomState::new().build_hasher().finish() | 1;
+            }
+
+            x ^= x >> 12;
+            x ^= x << 25;
+            x ^= x >> 27;
+            state.set(x);
+            x.wrapping_mul(0x2545_F491_4F6C_DD1D)
+        })
+        .unwrap_or(0)
+}
+
+impl Sampler {
+    pub fn new(level: LevelFilter, sampling: Sampling) -> Self {
+        Self {
+            level,
+            sampling,
+            count: AtomicU64::new(0),
+        }
+    }
+
+    /// Decides whether to keep a record, before anything is formatted.
+    #[inline]
+    pub fn keep(&self, level: log::Level) -> bool {
+        if level < self.level {
+            return true;
+        }
+
+        match self.sampling.0 {
+            Rate::Every(n) => self.count.fetch_add(1, Ordering::Relaxed) % n == 0,
+            Rate::Random(threshold) => (next() >> 32) < threshold,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn kept(sampler: &Sampler, level: log::Level) -> usize {
+        (0..10_000).filter(|_| sampler.keep(level)).count()
+    }
+
+    #[test]
+    fn test_sampling() {
+        let sampler = Sampler::new(LevelFilter::Debug, Sampling::one_in(10));
+
+        // Less verbose levels are always kept.
+        assert_eq!(kept(&sampler, log::Level::Info), 10_000);
+
+        for level in [log::Level::Debug, log::Level::Trace] {
+            assert_eq!(kept(&sampler, level), 1_000);
+        }
+
+        // Exactly every tenth record, starting with the first.
+        let sampler = Sampler::new(LevelFilter::Debug, Sampling::one_in(10));
+        let kept: Vec<_> = (0..30)
+            .filter(|_| sampler.keep(log::Level::Debug))
+            .collect();
+        assert_eq!(kept, [0, 10, 20]);
+    }
+
+    #[test]
+    fn test_fractions() {
+        let sampler = |fraction| Sampler::new(LevelFilter::Trace, Sampling::fraction(fraction));
+
+        assert_eq!(kept(&sampler(1.0), log::Level::Trace), 10_000);
+        assert_eq!(kept(&sampler(2.0), log::Level::Trace), 10_000);
+        assert_eq!(kept(&sampler(0.0), log::Level::Trace), 0);
+        assert_eq!(kept(&sampler(f64::NAN), log::Level::Trace), 0);
+        assert_eq!(
+            kept(
+                &Sampler::new(LevelFilter::Trace, Sampling::one_in(1)),
+                log::Level::Trace
+            ),
+            10_000
+        );
+
+        let kept = kept(&sampler(0.5), log::Level::Trace);
+        assert!((4500..5500).contains(&kept), "kept {}", kept);
+    }
+}
@@ -0,0 +1,208 @@
+use crate::format::Buffer;
+use crate::sys::*;
+use crate::OsLog;
+use std::ffi::c_void;
+
+crate::__os_log_string!(EMPTY_FORMAT, 1, [0]);
+
+/// Emits a signpost event, optionally with a static format string and typed
+/// arguments as accepted by `os_log!`. Nothing is encoded unless signposts are
+/// being recorded for the log, by Instruments for example.
+///
+/// ```
+/// use oslog::{os_signpost_event, OsLog, SignpostId};
+///
+/// let log = OsLog::new("com.example.test", "Requests");
+/// os_signpost_event!(log, SignpostId::EXCLUSIVE, "Cache miss");
+/// os_signpost_event!(log, SignpostId::EXCLUSIVE, "Cache miss", "key %s", "settings");
+/// ```
+#[macro_export]
+macro_rules! os_signpost_event {
+    ($log:expr, $id:expr, $name:literal $(, $format:literal $(, $arg:expr)*)? $(,)?) => {{
+        let log: &$crate::OsLog = &$log;
+        let id: $crate::SignpostId = $id;
+
+        if log.signposts_enabled() {
+            $crate::__os_signpost_name!(NAME, $name);
+            $crate::__os_log_emit!(
+                $crate::__os_signpost_format!($($format)?),
+                [$($($arg),*)?],
+                emit_signpost(log, $crate::__private::OS_SIGNPOST_EVENT, id, &NAME)
+            );
+        }
+    }};
+}
+
+/// Begins a signpost interval, optionally with a static format string and
+/// typed arguments as accepted by `os_log!`, and evaluates to a
+/// `SignpostInterval` which ends it when dropped. Nothing is encoded, and no
+/// identifier is generated, unless signposts are being recorded for the log.
+///
+/// ```
+/// use oslog::{os_signpost_interval, OsLog};
+///
+/// let log = OsLog::new("com.example.test", "Requests");
+/// let _interval = os_signpost_interval!(log, "Request", "path %s", "/index.html");
+/// ```
+#[macro_export]
+macro_rules! os_signpost_interval {
+    ($log:expr, $name:literal $(, $format:literal $(, $arg:expr)*)? $(,)?) => {{
+        let log: &$crate::OsLog = &$log;
+
+        if log.signposts_enabled() {
+            $crate::__os_signpost_name!(NAME, $name);
+            let id = $crate::SignpostId::generate(log);
+
+            $crate::__os_log_emit!(
+                $crate::__os_signpost_format!($($format)?),
+                [$($($arg),*)?],
+                emit_signpost(log, $crate::__private::OS_SIGNPOST_INTERVAL_BEGIN, id, &NAME)
+            );
+
+            unsafe { $crate::SignpostInterval::begun(log, id, &NAME) }
+        } else {
+            $crate::SignpostInterval::disabled()
+        }
+    }};
+}
+
+#[macro_export]
+#[doc(hidden)]
+macro_rules! __os_signpost_name {
+    ($ident:ident, $name:literal) => {
+        $crate::__os_log_string!($ident, $name.len() + 1, $crate::format::terminate($name));
+    };
+}
+
+#[macro_export]
+#[doc(hidden)]
+macro_rules! __os_signpost_format {
+    () => {
+        ""
+    };
+    ($format:literal) => {
+        $format
+    };
+}
+
+/// Identifies a signpost interval, and any events which relate to it, among
+/// others with the same name.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct SignpostId(pub(crate) os_signpost_id_t);
+
+impl SignpostId {
+    pub const NULL: Self = Self(OS_SIGNPOST_ID_NULL);
+    pub const INVALID: Self = Self(OS_SIGNPOST_ID_INVALID);
+
+    /// For intervals which never overlap others with the same name.
+    pub const EXCLUSIVE: Self = Self(OS_SIGNPOST_ID_EXCLUSIVE);
+
+    /// Generates an identifier which is unique among those for `log`.
+    pub fn generate(log: &OsLog) -> Self {
+        Self(unsafe { os_signpost_id_generate(log.inner) })
+    }
+
+    /// Derives an identifier from a pointer, so code which only has the
+    /// pointer can find the same identifier again.
+    pub fn with_pointer<T>(log: &OsLog, pointer: *const T) -> Self {
+        Self(unsafe { os_signpost_id_make_with_pointer(log.inner, pointer as *const c_void) })
+    }
+}
+
+/// A signpost interval which has begun, and ends when this is dropped.
+#[must_use = "the interval ends as soon as this is dropped"]
+pub struct SignpostInterval<'a> {
+    state: Option<(&'a OsLog, SignpostId, &'static [u8])>,
+}
+
+impl<'a> SignpostInterval<'a> {
+    /// # Safety
+    ///
+    /// `name` must be nul terminated and stored in the `__oslogstring`
+    /// section, as `os_signpost_interval!` does.
+    #[doc(hidden)]
+    pub unsafe fn begun(log: &'a OsLog, id: SignpostId, name: &'static [u8]) -> Self {
+        Self {
+            state: Some((log, id, name)),
+        }
+    }
+
+    /// An interval which does nothing, because signposts aren't enabled.
+    #[doc(hidden)]
+    pub fn disabled() -> Self {
+        Self { state: None }
+    }
+
+    /// The interval's identifier, or `None` if signposts weren't enabled when
+    /// it began.
+    pub fn id(&self) -> Option<SignpostId> {
+        self.state.map(|(_, id, _)| id)
+    }
+}
+
+impl Drop for SignpostInterval<'_> {
+    fn drop(&mut self) {
+        if let Some((log, id, name)) = self.state {
+            let mut storage = [0u8; 2];
+
+            unsafe {
+                Buffer::new(&mut storage).emit_signpost(
+                    log,
+                    OS_SIGNPOST_INTERVAL_END,
+                    id,
+                    name,
+                    &EMPTY_FORMAT,
+                )
+            }
+        }
+    }
+}
+
+impl OsLog {
+    /// Whether signposts are being recorded for this log, which is usually
+    /// only the case while Instruments is attached.
+    pub fn signposts_enabled(&self) -> bool {
+        unsafe { os_signpost_enabled(self.inner) }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_ids() {
+        let log = OsLog::new("com.example.oslog", "signpost");
+        let value = 1;
+
+        assert_ne!(SignpostId::generate(&log), SignpostId::NULL);
+        assert_eq!(
+            SignpostId::with_pointer(&log, &value),
+            SignpostId::with_pointer(&log, &value)
+        );
+    }
+
+    #[test]
+    fn test_events() {
+        let log = OsLog::new("com.example.oslog", "signpost");
+        let name = String::from("name");
+
+        crate::os_signpost_event!(log, SignpostId::EXCLUSIVE, "Event");
+        crate::os_signpost_event!(log, SignpostId::generate(&log), "Event", "Static");
+        crate::os_signpost_event!(log, SignpostId::EXCLUSIVE, "Event", "%s %d", name, 1);
+    }
+
+    #[test]
+    fn test_intervals() {
+        let log = OsLog::new("com.example.oslog", "signpost");
+
+        let interval = crate::os_signpost_interval!(log, "Interval");
+        assert_eq!(interval.id().is_some(), log.signposts_enabled());
+        drop(interval);
+
+        let _nested = crate::os_signpost_interval!(log, "Interval", "%{public}s", "outer");
+        let _inner = crate::os_signpost_interval!(log, "Inner", "%u", 2u32);
+
+        assert!(SignpostInterval::disabled().id().is_none());
+    }
+}
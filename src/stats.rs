@@ -0,0 +1,238 @@
+use std::fmt;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::OnceLock;
+use std::time::{Duration, Instant};
+
+/// One in this many formatted records is timed, and the time it took is
+/// scaled up to stand for the others.
+const TIMING_INTERVAL: u64 = 64;
+
+/// The most copies of each category's counters which threads are spread
+/// over. A power of two, as is the number actually used.
+const MAX_STRIPES: usize = 16;
+
+static NEXT_STRIPE: AtomicUsize = AtomicUsize::new(0);
+
+thread_local! {
+    /// The stripe this thread updates, handed out in turn.
+    static STRIPE: usize = NEXT_STRIPE.fetch_add(1, Ordering::Relaxed) % MAX_STRIPES;
+}
+
+/// One stripe per CPU, up to `MAX_STRIPES`, so small machines don't pay for
+/// stripes they can't use.
+fn stripe_count() -> usize {
+    static COUNT: OnceLock<usize> = OnceLock::new();
+
+    *COUNT.get_or_init(|| {
+        std::thread::available_parallelism()
+            .map_or(1, |cpus| cpus.get())
+            .next_power_of_two()
+            .min(MAX_STRIPES)
+    })
+}
+
+/// One copy of the counters, on a cache line of its own.
+#[derive(Default)]
+#[repr(align(128))]
+struct Stripe {
+    emitted: AtomicU64,
+    filtered: AtomicU64,
+    rate_limited: AtomicU64,
+    sampled_out: AtomicU64,
+    dropped: AtomicU64,
+    formatted: AtomicU64,
+    formatted_bytes: AtomicU64,
+    formatting_nanos: AtomicU64,
+}
+
+/// Counters for a single category, which are only ever updated with relaxed
+/// atomics so keeping them costs next to nothing per record. They're striped,
+/// so threads logging to the same category don't fight over a cache line, and
+/// added up when they're read.
+pub(crate) struct Stats {
+    stripes: Box<[Stripe]>,
+}
+
+impl Default for Stats {
+    fn default() -> Self {
+        Self {
+            stripes: (0..stripe_count()).map(|_| Stripe::default()).collect(),
+        }
+    }
+}
+
+impl Stats {
+    #[inline]
+    fn add(counter: &AtomicU64, value: u64) {
+        counter.fetch_add(value, Ordering::Relaxed);
+    }
+
+    /// This thread's stripe.
+    #[inline]
+    fn stripe(&self) -> &Stripe {
+        let stripe = STRIPE.try_with(|stripe| *stripe).unwrap_or(0);
+        &self.stripes[stripe & (self.stripes.len() - 1)]
+    }
+
+    #[inline]
+    pub fn emitted(&self) {
+        Self::add(&self.stripe().emitted, 1);
+    }
+
+    #[inline]
+    pub fn filtered(&self) {
+        Self::add(&self.stripe().filtered, 1);
+    }
+
+    #[inline]
+    pub fn rate_limited(&self) {
+        Self::add(&self.stripe().rate_limited, 1);
+    }
+
+    #[inline]
+    pub fn sampled_out(&self) {
+        Self::add(&self.stripe().sampled_out, 1);
+    }
+
+    #[inline]
+    pub fn dropped(&self) {
+        Self::add(&self.stripe().dropped, 1);
+    }
+
+    pub fn snapshot(&self, category: &str) -> CategoryStats {
+        let load = |counter: fn(&Stripe) -> &AtomicU64| {
+            self.stripes
+                .iter()
+                .map(|stripe| counter(stripe).load(Ordering::Relaxed))
+                .sum()
+        };
+
+        CategoryStats {
+            category: category.to_string(),
+            emitted: load(|stripe| &stripe.emitted),
+            filtered: load(|stripe| &stripe.filtered),
+            rate_limited: load(|stripe| &stripe.rate_limited),
+            sampled_out: load(|stripe| &stripe.sampled_out),
+            dropped: load(|stripe| &stripe.dropped),
+            formatted_bytes: load(|stripe| &stripe.formatted_bytes),
+            formatting_time: Duration::from_nanos(load(|stripe| &stripe.formatting_nanos)),
+        }
+    }
+}
+
+/// A snapshot of a category's counters, from `OsLoggerHandle::stats`.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct CategoryStats {
+    pub category: String,
+    /// Records which were logged, or queued to be.
+    pub emitted: u64,
+    /// Records which were discarded by a level filter, or because the OS
+    /// isn't collecting their level for the category.
+    pub filtered: u64,
+    /// Records which were discarded by the category's rate limit.
+    pub rate_limited: u64,
+    /// Records which were left out of the category's sample.
+    pub sampled_out: u64,
+    /// Records which were discarded because the asynchronous queue was full.
+    pub dropped: u64,
+    /// How many bytes records' messages were formatted into. Messages which
+    /// needed no formatting aren't counted.
+    pub formatted_bytes: u64,
+    /// An estimate of the time spent formatting messages, from timing a
+    /// sample of them.
+    pub formatting_time: Duration,
+}
+
+/// Formats the arguments while counting the bytes they produce into the
+/// category's stats, and times a sample of them.
+pub(crate) struct Measured<'a> {
+    pub args: fmt::Arguments<'a>,
+    pub stats: &'a Stats,
+}
+
+impl fmt::Display for Measured<'_> {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        struct Counter<'a, 'b> {
+            f: &'a mut fmt::Formatter<'b>,
+            bytes: u64,
+        }
+
+        impl fmt::Write for Counter<'_, '_> {
+            fn write_str(&mut self, s: &str) -> fmt::Result {
+                self.bytes += s.len() as u64;
+                self.f.write_str(s)
+            }
+        }
+
+        let stripe = self.stats.stripe();
+        let timed = stripe.formatted.fetch_add(1, Ordering::Relaxed) % TIMING_INTERVAL == 0;
+        let start = if timed { Some(Instant::now()) } else { None };
+
+        let mut counter = Counter { f, bytes: 0 };
+        let result = fmt::write(&mut counter, self.args);
+
+        Stats::add(&stripe.formatted_bytes, counter.bytes);
+
+        if let Some(start) = start {
+            let nanos = start.elapsed().as_nanos() as u64;
+            Stats::add(
+                &stripe.formatting_nanos,
+                nanos.saturating_mul(TIMING_INTERVAL),
+            );
+        }
+
+        result
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_measured() {
+        let stats = Stats::default();
+        let value = 12;
+
+        let formatted = Measured {
+            args: format_args!("Value {}", value),
+            stats: &stats,
+        }
+        .to_string();
+
+        assert_eq!(formatted, "Value 12");
+
+        stats.emitted();
+        stats.filtered();
+        stats.filtered();
+
+        let snapshot = stats.snapshot("Measured");
+        assert_eq!(snapshot.category, "Measured");
+        assert_eq!(snapshot.emitted, 1);
+        assert_eq!(snapshot.filtered, 2);
+        assert_eq!(snapshot.rate_limited, 0);
+        assert_eq!(snapshot.formatted_bytes, 8);
+    }
+
+    #[test]
+    fn test_stripes() {
+        let stats = Stats::default();
+
+        std::thread::scope(|scope| {
+            for _ in 0..2 * MAX_STRIPES {
+                scope.spawn(|| {
+                    for _ in 0..100 {
+                        stats.emitted();
+                    }
+                });
+            }
+        });
+
+        // Every thread's stripe is added up, including shared ones.
+        assert_eq!(
+            stats.snapshot("Stripes").emitted,
+            2 * MAX_STRIPES as u64 * 100
+        );
+        assert!(stats.stripes.len().is_power_of_two() && stats.stripes.len() <= MAX_STRIPES);
+    }
+}
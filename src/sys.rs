@@ -1,7 +1,10 @@
 #![allow(non_camel_case_types)]
 #![allow(dead_code)]
 
-use std::{ffi::c_void, os::raw::c_char};
+use std::{
+    ffi::c_void,
+    os::raw::{c_char, c_int, c_uint},
+};
 
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
@@ -18,22 +21,117 @@ pub const OS_LOG_TYPE_DEBUG: os_log_type_t = 2;
 pub const OS_LOG_TYPE_ERROR: os_log_type_t = 16;
 pub const OS_LOG_TYPE_FAULT: os_log_type_t = 17;
 
+pub type os_signpost_id_t = u64;
+pub type os_signpost_type_t = u8;
+
+pub const OS_SIGNPOST_ID_NULL: os_signpost_id_t = 0;
+pub const OS_SIGNPOST_ID_INVALID: os_signpost_id_t = !0;
+pub const OS_SIGNPOST_ID_EXCLUSIVE: os_signpost_id_t = 0xEEEE_B0B5_B2B2_EEEE;
+
+pub const OS_SIGNPOST_EVENT: os_signpost_type_t = 0;
+pub const OS_SIGNPOST_INTERVAL_BEGIN: os_signpost_type_t = 1;
+pub const OS_SIGNPOST_INTERVAL_END: os_signpost_type_t = 2;
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct os_activity_s {
+    _unused: [u8; 0],
+}
+
+pub type os_activity_t = *mut os_activity_s;
+pub type os_activity_id_t = u64;
+pub type os_activity_flag_t = u32;
+
+pub const OS_ACTIVITY_FLAG_DEFAULT: os_activity_flag_t = 0;
+pub const OS_ACTIVITY_FLAG_DETACHED: os_activity_flag_t = 1;
+pub const OS_ACTIVITY_FLAG_IF_NONE_PRESENT: os_activity_flag_t = 2;
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone, Default)]
+pub struct os_activity_scope_state_s {
+    pub opaque: [u64; 2],
+}
+
+/// A message for `wrapped_os_log_batch`, which needn't be nul terminated.
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct wrapped_os_log_message {
+    pub log_type: os_log_type_t,
+    pub length: c_int,
+    pub message: *const c_char,
+}
+
 /// Provided by the OS.
 extern "C" {
     pub fn os_log_create(subsystem: *const c_char, category: *const c_char) -> os_log_t;
     pub fn os_release(object: *mut c_void);
     pub fn os_log_type_enabled(log: os_log_t, level: os_log_type_t) -> bool;
+    pub fn os_signpost_enabled(log: os_log_t) -> bool;
+    pub fn os_signpost_id_generate(log: os_log_t) -> os_signpost_id_t;
+    pub fn os_signpost_id_make_with_pointer(log: os_log_t, ptr: *const c_void) -> os_signpost_id_t;
+    pub fn os_activity_scope_enter(activity: os_activity_t, state: *mut os_activity_scope_state_s);
+    pub fn os_activity_scope_leave(state: *mut os_activity_scope_state_s);
+    pub fn os_activity_apply_f(
+        activity: os_activity_t,
+        context: *mut c_void,
+        function: extern "C" fn(*mut c_void),
+    );
+    pub fn os_activity_get_identifier(
+        activity: os_activity_t,
+        parent_id: *mut os_activity_id_t,
+    ) -> os_activity_id_t;
+}
+
+// Provided by the C library.
+extern "C" {
+    pub fn pthread_atfork(
+        prepare: Option<extern "C" fn()>,
+        parent: Option<extern "C" fn()>,
+        child: Option<extern "C" fn()>,
+    ) -> c_int;
 }
 
 /// Wrappers defined in wrapper.c because most of the os_log_* APIs are macros.
 extern "C" {
     pub fn wrapped_get_default_log() -> os_log_t;
     pub fn wrapped_os_log_with_type(log: os_log_t, log_type: os_log_type_t, message: *const c_char);
-    pub fn wrapped_os_log_debug(log: os_log_t, message: *const c_char);
-    pub fn wrapped_os_log_info(log: os_log_t, message: *const c_char);
-    pub fn wrapped_os_log_default(log: os_log_t, message: *const c_char);
-    pub fn wrapped_os_log_error(log: os_log_t, message: *const c_char);
-    pub fn wrapped_os_log_fault(log: os_log_t, message: *const c_char);
+    pub fn wrapped_os_log_batch(
+        log: os_log_t,
+        messages: *const wrapped_os_log_message,
+        count: usize,
+    );
+    pub fn wrapped_os_log_with_location(
+        log: os_log_t,
+        log_type: os_log_type_t,
+        file: *const c_char,
+        file_len: c_int,
+        line: c_uint,
+        module: *const c_char,
+        module_len: c_int,
+        message: *const c_char,
+        message_len: c_int,
+    );
+    pub fn wrapped_os_activity_create(
+        description: *const c_char,
+        flags: os_activity_flag_t,
+    ) -> os_activity_t;
+    pub fn wrapped_os_activity_current() -> os_activity_t;
+    pub fn wrapped_os_log_impl(
+        log: os_log_t,
+        log_type: os_log_type_t,
+        format: *const c_char,
+        buffer: *mut u8,
+        size: u32,
+    );
+    pub fn wrapped_os_signpost_emit(
+        log: os_log_t,
+        signpost_type: os_signpost_type_t,
+        id: os_signpost_id_t,
+        name: *const c_char,
+        format: *const c_char,
+        buffer: *mut u8,
+        size: u32,
+    );
 }
 
 #[cfg(test)]
@@ -58,12 +156,6 @@ mod tests {
         let message = CString::new("Hello!").unwrap();
 
         unsafe {
-            wrapped_os_log_debug(wrapped_get_default_log(), message.as_ptr());
-            wrapped_os_log_info(wrapped_get_default_log(), message.as_ptr());
-            wrapped_os_log_default(wrapped_get_default_log(), message.as_ptr());
-            wrapped_os_log_error(wrapped_get_default_log(), message.as_ptr());
-            wrapped_os_log_fault(wrapped_get_default_log(), message.as_ptr());
-
             wrapped_os_log_with_type(
                 wrapped_get_default_log(),
                 OS_LOG_TYPE_DEBUG,
@@ -100,12 +192,6 @@ mod tests {
         let message = CString::new("Hello!").unwrap();
 
         unsafe {
-            wrapped_os_log_debug(log, message.as_ptr());
-            wrapped_os_log_info(log, message.as_ptr());
-            wrapped_os_log_default(log, message.as_ptr());
-            wrapped_os_log_error(log, message.as_ptr());
-            wrapped_os_log_fault(log, message.as_ptr());
-
             wrapped_os_log_with_type(log, OS_LOG_TYPE_DEBUG, message.as_ptr());
             wrapped_os_log_with_type(log, OS_LOG_TYPE_INFO, message.as_ptr());
             wrapped_os_log_with_type(log, OS_LOG_TYPE_DEFAULT, message.as_ptr());
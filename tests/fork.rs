@@ -0,0 +1,91 @@
+//! Runs in its own process, so the logger installed here is the only one and
+//! no other test's threads are around when it forks.
+
+use log::{error, LevelFilter};
+use oslog::OsLogger;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+
+extern "C" {
+    fn fork() -> i32;
+    fn waitpid(pid: i32, status: *mut i32, options: i32) -> i32;
+    fn alarm(seconds: u32) -> u32;
+    fn _exit(status: i32) -> !;
+}
+
+/// Forks, runs `f` in the child, and returns whether it succeeded. A child
+/// which deadlocks is killed after a few seconds.
+fn in_child(f: impl FnOnce()) -> bool {
+    let pid = unsafe { fork() };
+    assert!(pid >= 0);
+
+    if pid == 0 {
+        unsafe { alarm(5) };
+        let result = std::panic::catch_unwind(std::panic::AssertUnwindSafe(f));
+        unsafe { _exit(if result.is_ok() { 0 } else { 1 }) }
+    }
+
+    let mut status = -1;
+    assert_eq!(unsafe { waitpid(pid, &mut status, 0) }, pid);
+    status == 0
+}
+
+#[test]
+fn test_fork() {
+    let handle = OsLogger::new("com.example.oslog")
+        .level_filter(LevelFilter::Trace)
+        .asynchronous(16)
+        .init()
+        .unwrap();
+
+    error!(target: "Parent", "Record");
+    log::logger().flush();
+
+    // Only the forking thread exists in the child, so logging has to start a
+    // new background thread rather than wait on the parent's.
+    assert!(in_child(|| {
+        error!(target: "Parent", "Record");
+        error!(target: "Child", "Record");
+        log::logger().flush();
+    }));
+
+    // Another thread keeps taking the registries' locks while forking, which
+    // would leave them held in the child if they weren't taken across it.
+    #[cfg_attr(not(feature = "tracing"), allow(unused_mut))]
+    let mut registries = vec![handle];
+
+    #[cfg(feature = "tracing")]
+    registries.push(oslog::OsLogLayer::new("com.example.oslog").handle());
+
+    let stop = Arc::new(AtomicBool::new(false));
+    let busy = std::thread::spawn({
+        let registries = registries.clone();
+        let stop = stop.clone();
+
+        move || {
+            while !stop.load(Ordering::Relaxed) {
+                for handle in &registries {
+                    handle.clear_category_level_filter("Busy");
+                }
+            }
+        }
+    });
+
+    for _ in 0..20 {
+        assert!(in_child(|| {
+            for handle in &registries {
+                handle.clear_category_level_filter("Busy");
+            }
+
+            error!(target: "Child", "Record");
+            log::logger().flush();
+        }));
+    }
+
+    stop.store(true, Ordering::Relaxed);
+    busy.join().unwrap();
+
+    // The parent carries on as before.
+    error!(target: "Parent", "Record");
+    log::logger().flush();
+}
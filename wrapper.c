@@ -1,29 +1,64 @@
+#include <os/activity.h>
 #include <os/log.h>
+#include <os/signpost.h>
 
 os_log_t wrapped_get_default_log() {
     return OS_LOG_DEFAULT;
 }
 
+// The entry point for preformatted messages at every level. os_log_debug and
+// the rest only differ in the type they pass, so there's one function for the
+// linker to inline into Rust callers when cross-language LTO is enabled.
 void wrapped_os_log_with_type(os_log_t log, os_log_type_t type, const char* message) {
     os_log_with_type(log, type, "%{public}s", message);
 }
 
-void wrapped_os_log_debug(os_log_t log, const char* message) {
-    os_log_debug(log, "%{public}s", message);
+// The shim OsLog::default called before every level went through
+// wrapped_os_log_with_type, kept only as the baseline for the levels benchmark.
+// It's never inlined, so it stands for a call across the FFI boundary.
+__attribute__((noinline)) void wrapped_os_log_default_baseline(os_log_t log, const char* message) {
+    os_log(log, "%{public}s", message);
 }
 
-void wrapped_os_log_info(os_log_t log, const char* message) {
-    os_log_info(log, "%{public}s", message);
+typedef struct {
+    os_log_type_t type;
+    int length;
+    const char* message;
+} wrapped_os_log_message;
+
+// Logs several messages with one call from Rust. Each message is passed with
+// its length, so it doesn't need to be copied to nul terminate it.
+void wrapped_os_log_batch(os_log_t log, const wrapped_os_log_message* messages, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        os_log_with_type(log, messages[i].type, "%{public}.*s", messages[i].length, messages[i].message);
+    }
 }
 
-void wrapped_os_log_default(os_log_t log, const char* message) {
-    os_log(log, "%{public}s", message);
+// Logs a message along with where it was logged from, so the location is
+// stored as separate arguments rather than formatted into the message.
+void wrapped_os_log_with_location(os_log_t log, os_log_type_t type, const char* file, int file_len, unsigned int line, const char* module, int module_len, const char* message, int message_len) {
+    os_log_with_type(log, type, "%{public}.*s:%u %{public}.*s: %{public}.*s", file_len, file, line, module_len, module, message_len, message);
+}
+
+// Logs arguments which have already been encoded by the os_log! macro. This is
+// what os_log_with_type expands to, minus the encoding, and passing this
+// image's handle means the format string must be in the same image.
+void wrapped_os_log_impl(os_log_t log, os_log_type_t type, const char* format, uint8_t* buffer, uint32_t size) {
+    _os_log_impl((void*)&__dso_handle, log, type, format, buffer, size);
+}
+
+// Emits a signpost whose arguments have already been encoded, which is what the
+// os_signpost_* macros expand to. The name and format must be in this image.
+void wrapped_os_signpost_emit(os_log_t log, os_signpost_type_t type, os_signpost_id_t id, const char* name, const char* format, uint8_t* buffer, uint32_t size) {
+    _os_signpost_emit_with_name_impl((void*)&__dso_handle, log, type, id, name, format, buffer, size);
 }
 
-void wrapped_os_log_error(os_log_t log, const char* message) {
-    os_log_error(log, "%{public}s", message);
+// os_activity_create is a macro which passes this image's handle, so the
+// description must be in the same image.
+os_activity_t wrapped_os_activity_create(const char* description, os_activity_flag_t flags) {
+    return _os_activity_create((void*)&__dso_handle, description, OS_ACTIVITY_CURRENT, flags);
 }
 
-void wrapped_os_log_fault(os_log_t log, const char* message) {
-    os_log_fault(log, "%{public}s", message);
-}
\ No newline at end of file
+os_activity_t wrapped_os_activity_current() {
+    return OS_ACTIVITY_CURRENT;
+}